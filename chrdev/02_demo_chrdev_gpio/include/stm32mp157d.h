@@ -20,6 +20,17 @@
 #define GPIOI_PUPDR               (GPIOI_BASE + 0x000C)    
 #define GPIOI_BSRR               (GPIOI_BASE + 0x0018)    
 
+/* GPIO 组的寄存器块：整组映射一次，按成员访问，偏移由结构体布局决定 */
+struct stm32_gpio_regs {
+    u32 moder;      /* 0x00 模式 */
+    u32 otyper;     /* 0x04 输出类型 */
+    u32 ospeedr;    /* 0x08 输出速度 */
+    u32 pupdr;      /* 0x0C 上下拉 */
+    u32 idr;        /* 0x10 输入数据 */
+    u32 odr;        /* 0x14 输出数据 */
+    u32 bsrr;       /* 0x18 置位/复位（只写） */
+};
+
 void led_init(void); //需写出，否则其他c文件调用，提示非显性警告。
 void led_switch(u8 sta);
 void led_deinit(void);
@@ -38,12 +38,8 @@ writel 和 readl 是 Linux 内核中访问硬件寄存器的标准接口。
 __iomem：内核中用于标识 I/O 内存的修饰符，
 提醒编译器这些指针指向的是设备寄存器而非普通内存。 
 */
-static void __iomem *MPU_AHB4_PERIPH_RCC_PI; 
-static void __iomem *GPIOI_MODER_PI; 
-static void __iomem *GPIOI_OTYPER_PI; 
-static void __iomem *GPIOI_OSPEEDR_PI; 
-static void __iomem *GPIOI_PUPDR_PI; 
-static void __iomem *GPIOI_BSRR_PI; 
+static u32 __iomem *MPU_AHB4_PERIPH_RCC_PI;         /* RCC_MP_AHB4ENSETR：单个寄存器 */
+static struct stm32_gpio_regs __iomem *GPIOI_PI;    /* GPIOI 整组寄存器：一次映射 */
 
 
 /* 初始化 LED */ 
@@ -51,46 +47,46 @@ void led_init(void)
 {
     u32 val = 0;
 
-    /* 1、寄存器地址映射 */ 
+    /* 1、寄存器地址映射：RCC 只用一个寄存器；GPIOI 的寄存器同属一组，从组基址整组映射一次
+     *    （原先逐个映射 4 字节，OSPEEDR 还误映射成了 OTYPER 的地址） */ 
     MPU_AHB4_PERIPH_RCC_PI = ioremap(RCC_MP_AHB4ENSETR, 4); 
-    GPIOI_MODER_PI         = ioremap(GPIOI_MODER, 4); 
-    GPIOI_OTYPER_PI        = ioremap(GPIOI_OTYPER, 4); 
-    GPIOI_OSPEEDR_PI       = ioremap(GPIOI_OTYPER, 4); 
-    GPIOI_PUPDR_PI         = ioremap(GPIOI_PUPDR, 4); 
-    GPIOI_BSRR_PI          = ioremap(GPIOI_BSRR, 4); 
+    GPIOI_PI               = ioremap(GPIOI_BASE, sizeof(*GPIOI_PI)); 
     
+    /* 
+     * 下面全部用不带屏障的 _relaxed 访问：同一外设的寄存器访问本身保序，
+     * 只在 RCC 和 GPIOI 两个外设之间放一道屏障，保证先开时钟再配置 GPIO。
+     */
     /* 2、使能 PI 时钟 */ 
-    val = readl(MPU_AHB4_PERIPH_RCC_PI); 
+    val = readl_relaxed(MPU_AHB4_PERIPH_RCC_PI); 
     val &= ~(0X1 << 8);                 /* 清除以前的设置   */ 
     val |= (0X1 << 8);                  /* 设置新值      */ 
-    writel(val, MPU_AHB4_PERIPH_RCC_PI); 
+    writel_relaxed(val, MPU_AHB4_PERIPH_RCC_PI); 
+    mb();
     
     /* 3、设置 PI0 通用的输出模式。*/ 
-    val = readl(GPIOI_MODER_PI); 
+    val = readl_relaxed(&GPIOI_PI->moder); 
     val &= ~(0X3 << 0);                 /* bit0:1 清零    */ 
     val |= (0X1 << 0);                  /* bit0:1 设置 01   */ 
-    writel(val, GPIOI_MODER_PI); 
+    writel_relaxed(val, &GPIOI_PI->moder); 
     
     /* 3、设置 PI0 为推挽模式。*/ 
-    val = readl(GPIOI_OTYPER_PI); 
+    val = readl_relaxed(&GPIOI_PI->otyper); 
     val &= ~(0X1 << 0);                 /* bit0 清零，设置为上拉*/ 
-    writel(val, GPIOI_OTYPER_PI); 
+    writel_relaxed(val, &GPIOI_PI->otyper); 
     /* 4、设置 PI0 为高速。*/ 
-    val = readl(GPIOI_OSPEEDR_PI); 
+    val = readl_relaxed(&GPIOI_PI->ospeedr); 
     val &= ~(0X3 << 0);                 /* bit0:1 清零     */ 
     val |= (0x2 << 0);                  /* bit0:1 设置为 10   */ 
-    writel(val, GPIOI_OSPEEDR_PI); 
+    writel_relaxed(val, &GPIOI_PI->ospeedr); 
     
     /* 5、设置 PI0 为上拉。*/ 
-    val = readl(GPIOI_PUPDR_PI); 
+    val = readl_relaxed(&GPIOI_PI->pupdr); 
     val &= ~(0X3 << 0);                 /* bit0:1 清零     */ 
     val |= (0x1 << 0);                  /*bit0:1 设置为 01    */ 
-    writel(val,GPIOI_PUPDR_PI); 
+    writel_relaxed(val, &GPIOI_PI->pupdr); 
     
-    /* 6、默认关闭 LED */ 
-    val = readl(GPIOI_BSRR_PI); 
-    val |= (0x1 << 0); 
-    writel(val, GPIOI_BSRR_PI); 
+    /* 6、默认关闭 LED：BSRR 只写，直接写置位位即可 */ 
+    writel_relaxed(0x1 << 0, &GPIOI_PI->bsrr); 
 }
 
 /* 
@@ -100,17 +96,13 @@ void led_init(void)
  */ 
 void led_switch(u8 sta)
 { 
-    u32 val = 0;
+    /* BSRR 只写：读出来的值没有意义，直接写置位/复位位，一次访问 */
     if(sta == LEDON)
     {
-        val = readl(GPIOI_BSRR_PI);
-        val |= (1 << 16);
-        writel(val, GPIOI_BSRR_PI);
+        writel_relaxed(1 << 16, &GPIOI_PI->bsrr);
     }else if(sta == LEDOFF)
     {
-        val = readl(GPIOI_BSRR_PI);
-        val|= (1 << 0);
-        writel(val, GPIOI_BSRR_PI);
+        writel_relaxed(1 << 0, &GPIOI_PI->bsrr);
     }
 }
 
@@ -122,11 +114,7 @@ void led_deinit(void)
 {
     /* 解除映射 */ 
     iounmap(MPU_AHB4_PERIPH_RCC_PI); 
-    iounmap(GPIOI_MODER_PI); 
-    iounmap(GPIOI_OTYPER_PI); 
-    iounmap(GPIOI_OSPEEDR_PI); 
-    iounmap(GPIOI_PUPDR_PI); 
-    iounmap(GPIOI_BSRR_PI); 
+    iounmap(GPIOI_PI); 
     
     /* 应该还有其他硬件资源需要重置
      * 但是这里只是演示，无需太严格
@@ -7,324 +7,3183 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>  /* 用户空间数据拷贝 */
 #include <linux/slab.h>     /* 内核内存分配    */
+#include <linux/vmalloc.h>  /* 页面后备的缓冲区 */
+#include <linux/mm.h>       /* mmap 与缺页处理 */
+#include <linux/mutex.h>    /* FIFO 模式的互斥锁 */
+#include <linux/rwsem.h>    /* 调整缓冲区大小时的读写信号量 */
+#include <linux/xarray.h>   /* 稀疏模式的页索引 */
+#include <linux/seqlock.h>  /* 元数据快照 */
+#include <linux/rcupdate.h> /* 快照模式的版本发布 */
+#include <linux/kref.h>
+#include <linux/percpu.h>   /* 每 CPU 模式的记录环 */
+#include <linux/cpuhotplug.h>
+#include <linux/timekeeping.h>
+#include <linux/jump_label.h>  /* 插桩开关 */
+#include <linux/kthread.h>     /* 命令环的轮询线程 */
+#include <linux/debugfs.h>  /* 统计与延迟直方图 */
+#include <linux/seq_file.h>
+#include <linux/wait.h>     /* FIFO 模式的等待队列 */
+#include <linux/poll.h>     /* poll/epoll 支持 */
+#include <linux/uio.h>      /* iov_iter：readv/writev 分散聚集 */
+#include <linux/workqueue.h>    /* 异步读的完成工作 */
+#include <linux/aio.h>          /* kiocb_set_cancel_fn */
+#include <linux/sched/mm.h>     /* mmget/mmput */
 #include <linux/ioctl.h>    /* ioctl相关定义   */
 #include <linux/string.h>   /* 内核的 strlen() */
 #include <linux/platform_device.h>
 #include <linux/types.h>
 #include <linux/string.h>  /* 用内核自己的strcmp函数 */
 #include "chrdev_ioctl.h"
+#include "chrdev_compat.h"  /* 内核版本兼容层 */
+
+#define CREATE_TRACE_POINTS     /* 跟踪点只在本文件中实例化一次 */
+#include "chrdev_trace.h"
 #include "chrdev.h"         /* 自定义内核字符设备驱动框架信息 */
 #include "stm32mp157d.h"
 #include <linux/mod_devicetable.h> /* struct platform_device_id */
 #include <linux/io.h>
 #include <linux/of.h>          /* device-tree */
 #include <linux/of_address.h>  /* device-tree */
+#include <linux/regmap.h>      /* 寄存器访问与缓存 */
+#include <linux/pm.h>          /* 挂起/恢复时同步寄存器缓存 */
+#include <linux/delay.h>       /* 模拟寄存器的访问延迟 */
 
 static chrdev_t chrdev; //字符设备对象结构体（自定义的）
+
+/* 缓冲区工作模式：加载模块时指定，例如 insmod chrdev_platfrom_driver.ko buf_mode=1 */
+static int buf_mode = BUF_MODE_FLAT;
+module_param(buf_mode, int, 0444);
+MODULE_PARM_DESC(buf_mode, "缓冲区模式：0 平铺随机读写（默认），1 FIFO 环形流式读写，2 稀疏按页分配，3 RCU 快照，4 每 CPU 暂存按时间归并");
+
+/* 每次 open 独享一份缓冲区：各客户端互不干扰，无需用户空间加锁 */
+static bool per_open = false;
+module_param(per_open, bool, 0444);
+MODULE_PARM_DESC(per_open, "每次 open 分配独立的会话缓冲区（默认关闭，所有打开者共享一个缓冲区）");
+
+/* 次设备数量：0 表示取设备树属性 minor-count，设备树也没有则为 MINOR_COUNT */
+static unsigned int minor_count = 0;
+module_param(minor_count, uint, 0444);
+MODULE_PARM_DESC(minor_count, "次设备（独立缓冲区设备节点）的数量，1~32，默认取设备树 minor-count 属性或 1");
+
+/* 缓冲区的初始大小：各次设备和每个新会话按此分配，运行中可用 RESIZE_BUF 命令单独调整 */
+static unsigned int buf_size = BUF_SIZE;
+module_param(buf_size, uint, 0444);
+MODULE_PARM_DESC(buf_size, "缓冲区初始大小（字节），1~64MB（稀疏模式为逻辑大小，最大 1GB），默认 1024");
+
+/* 
+ * 可选插桩（计数器、延迟直方图）的总开关：static key 实现，关闭时热路径上只剩一条 nop，
+ * 不读时钟、不碰每 CPU 计数器。运行中可切换：
+ * echo 1 > /sys/module/chrdev_platfrom_driver/parameters/instrument
+ * tracepoint 本身也是 static key，未启用事件时同样没有开销，不归这个开关管。
+ */
+static DEFINE_STATIC_KEY_FALSE(instrument_key);
+static bool instrument = false;
+
+static int instrument_set(const char *val, const struct kernel_param *kp)
+{
+    int err = param_set_bool(val, kp);
+
+    if (err)
+        return err;
+    if (instrument)
+        static_branch_enable(&instrument_key);
+    else
+        static_branch_disable(&instrument_key);
+    return 0;
+}
+
+static const struct kernel_param_ops instrument_ops = {
+    .set = instrument_set,
+    .get = param_get_bool,
+};
+module_param_cb(instrument, &instrument_ops, &instrument, 0644);
+MODULE_PARM_DESC(instrument, "统计计数与延迟直方图（默认关闭，关闭时零开销；可在运行中经 sysfs 切换）");
+
+/* 寄存器模拟：没有开发板时用内存里的寄存器代替 GPIOI/RCC，驱动其余部分照常工作 */
+static bool sim = false;
+module_param(sim, bool, 0444);
+MODULE_PARM_DESC(sim, "自己注册一个用内存模拟 GPIOI/RCC 寄存器的平台设备，代替设备树描述的真实硬件（默认关闭）");
+
+/* 
+ * sim=1 时由本模块自己注册的模拟设备：设备的注销只发生在卸载本模块时，
+ * 而有打开者（fd、mmap、挂起的异步读都持有 file）时 fops.owner 让模块卸不掉，
+ * 所以 led_remove 不会赶在打开者前面拆掉缓冲区和 regmap。别处注册的同名设备一律不接。
+ */
+static struct platform_device *sim_pdev;
+
+static unsigned int sim_delay_ns = 0;
+module_param(sim_delay_ns, uint, 0644);
+MODULE_PARM_DESC(sim_delay_ns, "模拟寄存器每次访问的忙等延迟（纳秒），用来模拟慢速总线，默认 0");
+
+/* debugfs 根目录：每个次设备在其下有一个子目录 */
+static struct dentry *debug_root;
+
+/* 会话对象专用的 slab 缓存：open/release 频繁时比 kmalloc 更省、更快 */
+static struct kmem_cache *session_cache;
+
+static void fifo_aio_work(struct work_struct *work);
+static void fifo_aio_flush(struct cdev_private_data_t *data, struct file *filp);
+static int fifo_aio_cancel(struct kiocb *iocb);
+static void sparse_punch(struct cdev_private_data_t *data, size_t start);
+static struct cdev_snap_t *snap_alloc(size_t cap);
+static void snap_put(struct cdev_snap_t *snap);
+static int pcpu_data_init(struct cdev_private_data_t *data);
+static void pcpu_data_free(struct cdev_private_data_t *data);
+static void cdev_ring_free(struct cdev_private_data_t *data);
+static void cdev_ring_release(struct cdev_private_data_t *data, struct file *filp);
+
+/* 每 CPU 模式的 CPU 热插拔多实例状态：每份缓冲区私有数据是一个实例 */
+static enum cpuhp_state pcpu_hp_state;
+
+/* 缓冲区大小上限：稀疏模式只为写过的页付出内存，逻辑大小可以大得多 */
+static size_t buf_size_max(void)
+{
+    return (buf_mode == BUF_MODE_SPARSE) ? BUF_SIZE_SPARSE_MAX : BUF_SIZE_MAX;
+}
 /* 
 __iomem：内核中用于标识 I/O 内存的修饰符，
 提醒编译器这些指针指向的是设备寄存器而非普通内存。 
 */
-static void __iomem *MPU_AHB4_PERIPH_RCC_PI; 
-static void __iomem *GPIOI_MODER_PI; 
-static void __iomem *GPIOI_OTYPER_PI; 
-static void __iomem *GPIOI_OSPEEDR_PI; 
-static void __iomem *GPIOI_PUPDR_PI; 
-static void __iomem *GPIOI_BSRR_PI; 
+static u32 __iomem *MPU_AHB4_PERIPH_RCC_PI;         /* RCC_MP_AHB4ENSETR：单个寄存器 */
+static struct stm32_gpio_regs __iomem *GPIOI_PI;    /* GPIOI 整组寄存器：一次映射 */
+
+/* 
+ * 寄存器访问统一走 regmap-mmio：GPIOI 的配置寄存器带缓存，读改写的“读”命中缓存、值没变的写直接省掉，
+ * 挂起恢复后 regcache_sync 一次写回；寄存器内容在 /sys/kernel/debug/regmap/ 下可直接查看，
+ * 每次真实的总线访问都有 regmap:regmap_reg_read/regmap_reg_write 跟踪点可计数。
+ */
+static struct regmap *gpioi_map;
+static struct regmap *rcc_map;
+
+/* IDR/ODR 随引脚变化，BSRR 是只写的动作寄存器：都不进缓存 */
+static bool gpioi_volatile_reg(struct device *dev, unsigned int reg)
+{
+    return (reg == GPIO_REG(idr)) || (reg == GPIO_REG(odr)) || (reg == GPIO_REG(bsrr));
+}
+
+/* BSRR 读出来恒为 0，不让 debugfs 之类去读它 */
+static bool gpioi_readable_reg(struct device *dev, unsigned int reg)
+{
+    return reg != GPIO_REG(bsrr);
+}
+
+static const struct regmap_config gpioi_regmap_cfg = {
+    .name          = "gpioi",
+    .reg_bits      = 32,
+    .val_bits      = 32,
+    .reg_stride    = 4,
+    .max_register  = GPIO_REG(bsrr),
+    .volatile_reg  = gpioi_volatile_reg,
+    .readable_reg  = gpioi_readable_reg,
+    .cache_type    = REGCACHE_RBTREE,  /* 没有默认值表：第一次读时从硬件填入缓存 */
+    .fast_io       = true,             /* led_switch 在自旋锁里调用，用自旋锁而不是互斥锁 */
+#ifdef CHRDEV_HAVE_REGMAP_RELAXED_MMIO
+    .use_relaxed_mmio = true,
+#endif
+};
+
+/* RCC 的使能寄存器由整个 AHB4 上的外设共用，别的驱动也会改，不能缓存 */
+static const struct regmap_config rcc_regmap_cfg = {
+    .name          = "rcc",
+    .reg_bits      = 32,
+    .val_bits      = 32,
+    .reg_stride    = 4,
+    .max_register  = 0,
+    .cache_type    = REGCACHE_NONE,
+    .fast_io       = true,
+};
+
+/* 
+ * LED 状态的影子：BSRR 是只写的置位/复位寄存器，读出来的值没有意义，也读不出引脚现状。
+ * 开关灯只看影子决定要不要写，查询也只读影子，都不碰硬件；led_lock 保证比较和写寄存器是一体的，
+ * 并发开关灯时影子与引脚不会对不上。
+ */
+static u8 led_state = LEDOFF;
+static DEFINE_SPINLOCK(led_lock);
+
+/* 
+ * 模拟寄存器：挂在同样的 regmap 下，上层代码一行不改。按 STM32 的语义模拟：
+ * RCC 使能寄存器写 1 置位、写 0 无效；GPIOI 时钟没开时 GPIO 寄存器读为 0、写被丢弃；
+ * BSRR 的写折算到 ODR（同一引脚同时置位和复位时置位优先），读出恒为 0；
+ * IDR 只读，输出模式（MODER=01）引脚的电平跟随 ODR，其余引脚读为 0。
+ * 回调由各自 regmap 的锁串行化；计数只给 debugfs 看，不加锁。
+ */
+#define SIM_GPIO_NREGS  (sizeof(struct stm32_gpio_regs) / sizeof(u32))
+
+struct led_sim_regs_t {
+    u32 gpio[SIM_GPIO_NREGS];           /* GPIOI 寄存器块，下标 = 偏移 / 4 */
+    u32 rcc;                            /* RCC_MP_AHB4ENSETR */
+    u64 gpio_reads[SIM_GPIO_NREGS];
+    u64 gpio_writes[SIM_GPIO_NREGS];
+    u64 rcc_reads;
+    u64 rcc_writes;
+    u64 dropped;                        /* 时钟没开时被丢弃的 GPIO 写 */
+};
+
+static struct led_sim_regs_t *sim_regs; /* 模拟模式下的寄存器；真实硬件时为 NULL */
+
+static void sim_access_delay(void)
+{
+    unsigned int ns = READ_ONCE(sim_delay_ns);
+
+    if (ns)
+        ndelay(ns);
+}
+
+/* IDR：输出模式引脚反映 ODR */
+static u32 sim_gpio_idr(const struct led_sim_regs_t *s)
+{
+    u32 moder = s->gpio[GPIO_REG(moder) / sizeof(u32)];
+    u32 odr = s->gpio[GPIO_REG(odr) / sizeof(u32)];
+    u32 idr = 0;
+    int pin;
+
+    for (pin = 0; pin < 16; pin++)
+        if (((moder >> (2 * pin)) & 0x3) == 0x1)
+            idr |= odr & (1 << pin);
+    return idr;
+}
+
+static int sim_gpio_read(void *ctx, unsigned int reg, unsigned int *val)
+{
+    struct led_sim_regs_t *s = ctx;
+    unsigned int i = reg / sizeof(u32);
+
+    sim_access_delay();
+    s->gpio_reads[i]++;
+    if (!(READ_ONCE(s->rcc) & RCC_GPIOIEN))
+        *val = 0;
+    else if (reg == GPIO_REG(idr))
+        *val = sim_gpio_idr(s);
+    else if (reg == GPIO_REG(bsrr))
+        *val = 0;
+    else
+        *val = s->gpio[i];
+    return 0;
+}
+
+static int sim_gpio_write(void *ctx, unsigned int reg, unsigned int val)
+{
+    struct led_sim_regs_t *s = ctx;
+    unsigned int i = reg / sizeof(u32);
+    u32 *odr = &s->gpio[GPIO_REG(odr) / sizeof(u32)];
+
+    sim_access_delay();
+    s->gpio_writes[i]++;
+    if (!(READ_ONCE(s->rcc) & RCC_GPIOIEN)) {
+        s->dropped++;
+        return 0;
+    }
+    if (reg == GPIO_REG(bsrr))
+        *odr = (*odr & ~(val >> 16)) | (val & 0xFFFF);
+    else if (reg != GPIO_REG(idr))
+        s->gpio[i] = val;
+    return 0;
+}
+
+static int sim_rcc_read(void *ctx, unsigned int reg, unsigned int *val)
+{
+    struct led_sim_regs_t *s = ctx;
+
+    sim_access_delay();
+    s->rcc_reads++;
+    *val = READ_ONCE(s->rcc);
+    return 0;
+}
+
+static int sim_rcc_write(void *ctx, unsigned int reg, unsigned int val)
+{
+    struct led_sim_regs_t *s = ctx;
+
+    sim_access_delay();
+    s->rcc_writes++;
+    WRITE_ONCE(s->rcc, s->rcc | val);   /* 写 1 置位 */
+    return 0;
+}
+
+/* debugfs sim_regs：各寄存器的当前值和读写次数 */
+static int debug_sim_regs_show(struct seq_file *m, void *v)
+{
+    static const char * const names[SIM_GPIO_NREGS] = {
+        "MODER", "OTYPER", "OSPEEDR", "PUPDR", "IDR", "ODR", "BSRR"
+    };
+    struct led_sim_regs_t *s = m->private;
+    unsigned int i;
+
+    seq_printf(m, "%-8s %-10s %12s %12s\n", "reg", "value", "reads", "writes");
+    seq_printf(m, "%-8s 0x%08x %12llu %12llu\n", "RCC_EN", READ_ONCE(s->rcc), s->rcc_reads, s->rcc_writes);
+    for (i = 0; i < SIM_GPIO_NREGS; i++)
+        seq_printf(m, "%-8s 0x%08x %12llu %12llu\n", names[i],
+                   (i == GPIO_REG(idr) / sizeof(u32)) ? sim_gpio_idr(s) : s->gpio[i],
+                   s->gpio_reads[i], s->gpio_writes[i]);
+    seq_printf(m, "dropped  %llu\n", s->dropped);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(debug_sim_regs);
+
+/* 
+ * @description : 建立模拟寄存器及其 regmap，代替设备树解析和 ioremap
+ * @return      : 0 成功；-ENOMEM 或 regmap 初始化的错误码
+ */
+static int led_sim_setup(struct platform_device *pdev)
+{
+    struct regmap_config gpioi_cfg = gpioi_regmap_cfg;
+    struct regmap_config rcc_cfg = rcc_regmap_cfg;
+
+    sim_regs = devm_kzalloc(&pdev->dev, sizeof(*sim_regs), GFP_KERNEL);
+    if (!sim_regs)
+        return -ENOMEM;
+    sim_regs->gpio[GPIO_REG(moder) / sizeof(u32)] = 0xFFFFFFFF;   /* 复位值：全部为模拟模式 */
+
+    /* 不经总线，寄存器读写直接落到回调 */
+    gpioi_cfg.reg_read  = sim_gpio_read;
+    gpioi_cfg.reg_write = sim_gpio_write;
+    rcc_cfg.reg_read    = sim_rcc_read;
+    rcc_cfg.reg_write   = sim_rcc_write;
+    gpioi_map = devm_regmap_init(&pdev->dev, NULL, sim_regs, &gpioi_cfg);
+    if (IS_ERR(gpioi_map))
+        return PTR_ERR(gpioi_map);
+    rcc_map = devm_regmap_init(&pdev->dev, NULL, sim_regs, &rcc_cfg);
+    if (IS_ERR(rcc_map))
+        return PTR_ERR(rcc_map);
+
+    printk(KERN_INFO "LED 寄存器：使用内存模拟的 GPIOI/RCC（%s）\n", dev_name(&pdev->dev));
+    return 0;
+}
 
 /*************************************实际受控的硬件（GPIO）驱动代码：开始***************************************************/
 /* 初始化 LED */ 
 void led_init(void)
 {
-    u32 val = 0;
+    /* 1、寄存器地址映射 */ 
+    // 这部分代码，转移到了平台设备驱动模型中，前面已经解析出硬件信息，并建好了 regmap。
+    
+    /* 2、使能 PI 时钟。位已置上时 update_bits 不写；RCC 不缓存，读一次是免不了的 */ 
+    regmap_update_bits(rcc_map, 0, RCC_GPIOIEN, RCC_GPIOIEN);
+    mb();   /* 先开时钟再配置 GPIO：两个外设之间的访问不保序 */
+    
+    /* 
+     * 3~5：各寄存器第一次读时从硬件填进缓存，以后的读改写只剩“写”，
+     *      算出来的值与缓存相同时连写都省掉。
+     */
+    /* 3、设置 PI0 通用的输出模式。bit0:1 设置 01 */ 
+    regmap_update_bits(gpioi_map, GPIO_REG(moder), 0x3 << 0, 0x1 << 0);
+    /* 3、设置 PI0 为推挽模式。bit0 清零 */ 
+    regmap_update_bits(gpioi_map, GPIO_REG(otyper), 0x1 << 0, 0);
+    /* 4、设置 PI0 为高速。bit0:1 设置为 10 */ 
+    regmap_update_bits(gpioi_map, GPIO_REG(ospeedr), 0x3 << 0, 0x2 << 0);
+    /* 5、设置 PI0 为上拉。bit0:1 设置为 01 */ 
+    regmap_update_bits(gpioi_map, GPIO_REG(pupdr), 0x3 << 0, 0x1 << 0);
+    
+    /* 6、默认关闭 LED：BSRR 只写，直接写置位位即可 */ 
+    regmap_write(gpioi_map, GPIO_REG(bsrr), 0x1 << 0);
+    led_state = LEDOFF;
+}
+
+/* 
+ * @description : LED 打开/关闭：状态与影子相同时什么都不写，否则只写一次 BSRR（不先读）
+ * @param - sta : 打开LED:LEDON(1)；关闭LED:LEDOFF(0)
+ * @return      : true 实际写了寄存器；false 状态没变或 sta 非法
+ */ 
+bool led_switch(u8 sta)
+{ 
+    bool changed = false;
+
+    if ((sta != LEDON) && (sta != LEDOFF))
+        return false;
+
+    /* 无锁先看一眼影子：状态没变（写路径上的常态）就不碰全局锁，免得把并行的写者串起来；
+     * 要切换时在锁内再比一次 */
+    if (READ_ONCE(led_state) == sta)
+        return false;
+
+    spin_lock(&led_lock);
+    if (led_state != sta) {
+        /* 低电平点亮：BR0（bit16）拉低引脚开灯，BS0（bit0）拉高引脚关灯 */
+        regmap_write(gpioi_map, GPIO_REG(bsrr), (sta == LEDON) ? (1 << 16) : (1 << 0));  /* BSRR 不缓存，只此一次访问 */
+        WRITE_ONCE(led_state, sta);
+        changed = true;
+    }
+    spin_unlock(&led_lock);
+    if (changed)    /* 只记录真正写了寄存器的切换，跟踪与硬件动作一一对应 */
+        trace_chrdev_led_switch(sta);
+    return changed;
+}
+
+/* 
+ * @description : 读 LED 当前状态：只读影子，不访问硬件
+ * @return      : LEDON / LEDOFF
+ */ 
+u8 led_get(void)
+{
+    return READ_ONCE(led_state);
+}
+
+/* 
+ * @description :重置硬件资源
+ * @return      : 无
+ */ 
+void led_deinit(void)
+{
+    /* 解除映射：调用前字符设备须已注销（命令环轮询线程已停），regmap 由 devm 在驱动解绑后释放；
+     * 模拟模式下没有映射 */ 
+    if (MPU_AHB4_PERIPH_RCC_PI)
+        iounmap(MPU_AHB4_PERIPH_RCC_PI); 
+    if (GPIOI_PI)
+        iounmap(GPIOI_PI); 
+    MPU_AHB4_PERIPH_RCC_PI = NULL;
+    GPIOI_PI = NULL;
+    sim_regs = NULL;    /* 随设备由 devm 释放 */
+    
+    /* 应该还有其他硬件资源需要重置
+     * 但是这里只是演示，无需太严格
+     * 所以，只写这些，其他省略。
+    */
+    
+}
+
+/* 
+ * @description : 挂起：之后的访问只落在缓存里，并把缓存整体标脏，恢复时全部写回
+ * @return      : 0
+ */ 
+static int __maybe_unused led_suspend(struct device *dev)
+{
+    regcache_cache_only(gpioi_map, true);
+    regcache_mark_dirty(gpioi_map);
+    return 0;
+}
+
+/* 
+ * @description : 恢复：掉电后寄存器回到复位值，重开时钟、用缓存写回配置、再按影子恢复引脚
+ * @return      : 0 成功；其他 regcache_sync 的错误码
+ */ 
+static int __maybe_unused led_resume(struct device *dev)
+{
+    int ret;
+
+    regmap_update_bits(rcc_map, 0, RCC_GPIOIEN, RCC_GPIOIEN);
+    mb();
+    regcache_cache_only(gpioi_map, false);
+    ret = regcache_sync(gpioi_map);
+    if (ret)
+        return ret;
+
+    /* BSRR 不在缓存里：引脚电平由影子决定 */
+    spin_lock(&led_lock);
+    regmap_write(gpioi_map, GPIO_REG(bsrr), (led_state == LEDON) ? (1 << 16) : (1 << 0));
+    spin_unlock(&led_lock);
+    return 0;
+}
+
+static SIMPLE_DEV_PM_OPS(led_pm_ops, led_suspend, led_resume);
+
+/*************************************实际受控的硬件（GPIO）驱动代码：结束***************************************************/
+
+/* 
+ * @description : 初始化一份缓冲区私有数据：分配缓冲区，初始化锁和等待队列
+ * @return      : 0 成功；-ENOMEM 分配失败
+ */
+static int cdev_data_init(struct cdev_private_data_t *data, struct cdev_stats_t *stats)
+{
+    int i;
+
+    /* 缓冲区要映射到用户空间，必须按整页分配（kmalloc 的内存与其他对象共页，不能交给用户空间）。
+     * 分配时不清零：平铺模式的块代数全部从过期开始，读作全零，写入或映射时才逐块清零；
+     * FIFO 模式只读得到写进去的字节，用不着清零。 */
+    xa_init(&data->pages);
+    RCU_INIT_POINTER(data->snap, NULL);
+    data->buffer = NULL;  /* 稀疏模式不预先分配，也就不需要整块清零 */
+    data->chunk_gen = NULL;
+    data->clear_gen = 1;
+    data->ring = NULL;
+    if (buf_mode == BUF_MODE_PERCPU) {
+        if (pcpu_data_init(data))
+            return -ENOMEM;
+    } else if (buf_mode == BUF_MODE_SNAPSHOT) {
+        /* 初始版本是空的：容量为 0，第一次写入时才按 buf_size 生成带数据的版本 */
+        RCU_INIT_POINTER(data->snap, snap_alloc(0));
+        if (!rcu_access_pointer(data->snap))
+            return -ENOMEM;
+    } else if (buf_mode != BUF_MODE_SPARSE) {
+        data->buffer = vmalloc(PAGE_ALIGN(buf_size));
+        if (!data->buffer)
+            return -ENOMEM;
+        if (buf_mode == BUF_MODE_FLAT) {
+            data->chunk_gen = kvcalloc(PAGE_ALIGN(buf_size) >> CLEAR_CHUNK_SHIFT, sizeof(u32), GFP_KERNEL);
+            if (!data->chunk_gen) {
+                vfree(data->buffer);
+                data->buffer = NULL;
+                return -ENOMEM;
+            }
+        }
+    }
+    data->buf_size = buf_size;
+    data->data_len = 0;
+    data->wr_gen = 0;
+    seqlock_init(&data->meta_lock);
+    data->head = 0;
+    data->tail = 0;
+    mutex_init(&data->lock);
+    init_rwsem(&data->resize_sem);
+    for (i = 0; i < LOCK_STRIPES; i++)
+        init_rwsem(&data->stripes[i]);
+    atomic_set(&data->mmap_count, 0);
+    init_waitqueue_head(&data->rd_wq);
+    init_waitqueue_head(&data->wr_wq);
+    INIT_LIST_HEAD(&data->aio_list);
+    INIT_LIST_HEAD(&data->aio_cancelled);
+    spin_lock_init(&data->aio_lock);
+    INIT_WORK(&data->aio_work, fifo_aio_work);
+    data->stats = stats;
+    return 0;
+}
+
+static void cdev_data_free(struct cdev_private_data_t *data)
+{
+    /* 挂起的异步读各自持有 file 引用，走到这里时队列应当已空；万一还有，以 -ECANCELED 完成掉再等工作退出 */
+    fifo_aio_flush(data, NULL);
+    flush_work(&data->aio_work);
+    cancel_work_sync(&data->aio_work);
+    cdev_ring_free(data);
+    sparse_punch(data, 0);
+    xa_destroy(&data->pages);
+    if (rcu_access_pointer(data->snap))  /* 不会再有读者：放掉发布引用，内存在宽限期后释放 */
+        snap_put(rcu_dereference_protected(data->snap, 1));
+    RCU_INIT_POINTER(data->snap, NULL);
+    if (data->pcpu)
+        pcpu_data_free(data);
+    vfree(data->buffer);
+    data->buffer = NULL;
+    kvfree(data->chunk_gen);
+    data->chunk_gen = NULL;
+}
+
+/* 
+ * 元数据发布：buf_size、data_len、wr_gen 的每次改动都包在 meta_lock 的写临界区里
+ * （自旋锁串行化改动方，临界区只有几条赋值）；GET_DATA_LEN/GET_BUF_SIZE/GET_META 按序列号无锁读取，
+ * 读到一半被改动就重读，既不拿读写锁也不拖慢写者，调整大小或清空期间也总能得到一致的一组值。
+ */
+static void cdev_meta_snapshot(struct cdev_private_data_t *data, struct chrdev_meta *meta)
+{
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&data->meta_lock);
+        meta->buf_size = data->buf_size;
+        meta->data_len = data->data_len;
+        meta->wr_gen   = data->wr_gen;
+    } while (read_seqretry(&data->meta_lock, seq));
+}
+
+/* 有效数据长度只增不减地推到 end：并发写者各自推进，在写临界区里取最大值，不会互相覆盖 */
+static void data_len_extend(struct cdev_private_data_t *data, size_t end)
+{
+    write_seqlock(&data->meta_lock);
+    if (data->data_len < end)
+        data->data_len = end;
+    data->wr_gen++;
+    write_sequnlock(&data->meta_lock);
+}
+
+/* 
+ * 统计：计数器和延迟直方图都是每 CPU 的（struct cdev_pcpu_stats_t），热路径上只做 this_cpu_inc/this_cpu_add，
+ * 不写任何共享的缓存行；读 debugfs/sysfs 统计文件时才逐 CPU 求和。
+ * 全部受 instrument_key 控制：关闭期间不计数，已有的计数保留。
+ */
+#define cdev_stat_add(st, field, n)                         \
+    do {                                                    \
+        if (static_branch_unlikely(&instrument_key))        \
+            this_cpu_add((st)->pcpu->field, (n));           \
+    } while (0)
+#define cdev_stat_inc(st, field)    cdev_stat_add(st, field, 1)
+
+/* 计时起点：插桩关闭时不读时钟，返回 0 */
+static __always_inline u64 cdev_stat_begin(void)
+{
+    return static_branch_unlikely(&instrument_key) ? ktime_get_ns() : 0;
+}
+
+/* 记一次读/写/ioctl：调用次数、字节数、-ENOSPC/-EFAULT 事件，以及从 t0（ktime_get_ns）到现在的延迟 */
+static void __cdev_stat_op(struct cdev_stats_t *st, enum cdev_op op, long ret, u64 t0)
+{
+    struct cdev_pcpu_stats_t __percpu *pc = st->pcpu;
+    u64 ns = ktime_get_ns() - t0;
+
+    this_cpu_inc(pc->lat[op][min_t(unsigned int, fls64(ns), LAT_BUCKETS - 1)]);
+    switch (op) {
+        case CDEV_OP_READ:
+            this_cpu_inc(pc->reads);
+            if (ret > 0)
+                this_cpu_add(pc->bytes_read, ret);
+            break;
+        case CDEV_OP_WRITE:
+            this_cpu_inc(pc->writes);
+            if (ret > 0)
+                this_cpu_add(pc->bytes_written, ret);
+            break;
+        default:
+            this_cpu_inc(pc->ioctls);
+            break;
+    }
+    if (ret == -ENOSPC)
+        this_cpu_inc(pc->enospc);
+    else if (ret == -EFAULT)
+        this_cpu_inc(pc->efault);
+}
+
+/* t0 为 0：开始时插桩还关着，这一次不计 */
+static __always_inline void cdev_stat_op(struct cdev_stats_t *st, enum cdev_op op, long ret, u64 t0)
+{
+    if (static_branch_unlikely(&instrument_key) && t0)
+        __cdev_stat_op(st, op, ret, t0);
+}
+
+/* 把各 CPU 的统计加到 sum 里 */
+static void cdev_stats_sum(struct cdev_stats_t *st, struct cdev_pcpu_stats_t *sum)
+{
+    struct cdev_pcpu_stats_t *pc;
+    unsigned int cpu, op, i;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        pc = per_cpu_ptr(st->pcpu, cpu);
+        sum->opens         += pc->opens;
+        sum->reads         += pc->reads;
+        sum->writes        += pc->writes;
+        sum->ioctls        += pc->ioctls;
+        sum->bytes_read    += pc->bytes_read;
+        sum->bytes_written += pc->bytes_written;
+        sum->enospc        += pc->enospc;
+        sum->efault        += pc->efault;
+        sum->led_switches  += pc->led_switches;
+        for (op = 0; op < CDEV_OP_NR; op++)
+            for (i = 0; i < LAT_BUCKETS; i++)
+                sum->lat[op][i] += pc->lat[op][i];
+    }
+}
+
+/* 
+ * @description : 为本次 open 分配独立会话：会话对象取自 session_cache，
+ *                自带缓冲区和数据长度；读写游标就是本 filp 的 f_pos。
+ * @return      : 会话指针；NULL 分配失败
+ */
+static struct cdev_private_data_t *session_alloc(chrdev_minor_t *minor)
+{
+    struct cdev_private_data_t *data;
+
+    data = kmem_cache_zalloc(session_cache, GFP_KERNEL);
+    if (!data)
+        return NULL;
+    if (cdev_data_init(data, &minor->stats)) {  /* 会话的统计计入所属次设备 */
+        kmem_cache_free(session_cache, data);
+        return NULL;
+    }
+    data->per_open = true;
+    return data;
+}
+
+static void session_free(struct cdev_private_data_t *data)
+{
+    cdev_data_free(data);
+    kmem_cache_free(session_cache, data);
+}
+
+static int dev_open(struct inode *inode, struct file *filp) {
+    /* 每个次设备有自己的 cdev，由 inode->i_cdev 反推次设备对象，O(1) 查找 */
+    chrdev_minor_t *minor = container_of(inode->i_cdev, chrdev_minor_t, dev);
+
+    if (per_open) {
+        filp->private_data = session_alloc(minor);
+        if (!filp->private_data)
+            return -ENOMEM;
+    } else {
+        filp->private_data = &minor->dev_data;
+    }
+    filp->f_mode |= FMODE_NOWAIT;  /* 支持 IOCB_NOWAIT/RWF_NOWAIT：会阻塞时直接返回 -EAGAIN */
+    cdev_stat_inc(&minor->stats, opens);
+    /* FIFO 和每 CPU 模式是流式设备：没有文件偏移的概念，禁止 lseek/pread/pwrite */
+    if ((buf_mode == BUF_MODE_FIFO) || (buf_mode == BUF_MODE_PERCPU))
+        nonseekable_open(inode, filp);
+    trace_chrdev_open(minor->index, filp->f_flags);
+    return 0;
+}
+
+/* 
+ * @description : SEEK_DATA/SEEK_HOLE：从 offset 起找下一段数据/下一个空洞。
+ *                有效数据长度 data_len 之后视为文件末尾的隐式空洞，与普通文件一致。
+ *                稀疏模式按页判断：xarray 里有页即数据，没有即空洞；其余模式有效数据全是数据。
+ * @return      : 找到的偏移；-ENXIO offset 越过有效数据或其后再无数据
+ */
+static loff_t cdev_seek_data_hole(struct cdev_private_data_t *data, loff_t offset, int whence)
+{
+    loff_t end = data->data_len;
+    unsigned long index = offset >> PAGE_SHIFT;
+
+    if ((offset < 0) || (offset >= end))
+        return -ENXIO;
+    if (buf_mode != BUF_MODE_SPARSE)
+        return (whence == SEEK_DATA) ? offset : end;
+
+    if (whence == SEEK_DATA) {
+        if (!xa_find(&data->pages, &index, ULONG_MAX, XA_PRESENT))
+            return -ENXIO;
+        offset = max_t(loff_t, offset, (loff_t)index << PAGE_SHIFT);
+        return (offset < end) ? offset : -ENXIO;
+    }
+    while (xa_load(&data->pages, index))  /* 跳过连续的已分配页 */
+        index++;
+    return min_t(loff_t, max_t(loff_t, offset, (loff_t)index << PAGE_SHIFT), end);
+}
+
+/* llseek 函数跟字符设备驱动的数据，可以无任何直接关联，只通过 offset 间接关联。 */
+/* loff_t 类型是 signed long long 有符号数值 */
+static loff_t do_dev_llseek(struct file *filp, loff_t offset, int whence){
+
+    struct cdev_private_data_t *data = filp->private_data;
+    loff_t new_pos = 0;
+    /* 对进程的 f_ops 进行校验，防止意外 */
+    if ((filp->f_pos < 0) || (filp->f_pos > data->buf_size)) {
+        return -EINVAL;
+    }
+
+    switch (whence) {
+        case SEEK_SET:
+                if ((offset < 0) || (offset > data->buf_size)) {
+                    return -EINVAL;
+                }
+                filp->f_pos = offset;
+                break;
+
+        case SEEK_CUR:
+                new_pos = filp->f_pos + offset;
+                if ((new_pos < 0) || (new_pos > data->buf_size)){
+                    return -EINVAL;
+                }
+                filp->f_pos = new_pos;
+                break;
+
+        case SEEK_END:
+                new_pos = data->buf_size + offset;
+                if ((new_pos < 0) || (new_pos > data->buf_size)){
+                    return -EINVAL;
+                }
+                filp->f_pos = new_pos;
+                break;
+
+        case SEEK_DATA:
+        case SEEK_HOLE:
+                new_pos = cdev_seek_data_hole(data, offset, whence);
+                if (new_pos < 0)
+                    return new_pos;
+                filp->f_pos = new_pos;
+                break;
+
+        default: return -EINVAL; /* 禁止隐式偏移 */
+    }
+    return filp->f_pos;
+}
+
+/* 定位结果（含失败的错误码）由跟踪点 chrdev_llseek 记录 */
+loff_t dev_llseek(struct file *filp, loff_t offset, int whence)
+{
+    loff_t ret = do_dev_llseek(filp, offset, whence);
+
+    trace_chrdev_llseek(offset, whence, ret);
+    return ret;
+}
+
+/* 硬件LED灯控制部分：按写入数据的首字节决定开关灯 */
+static void dev_led_ctrl(struct cdev_private_data_t *data, char sta)
+{
+    /* 状态没变时 led_switch 不写寄存器，也就不计入开关次数 */
+    if(sta == LEDON) {
+        if (led_switch(LEDON))  /* 打开 LED 灯  */
+            cdev_stat_inc(data->stats, led_switches);
+    }
+    else if(sta == LEDOFF) { 
+        if (led_switch(LEDOFF))  /* 关闭 LED 灯  */
+            cdev_stat_inc(data->stats, led_switches);
+    }
+    else{
+        /* 首字节不是开关灯命令：常见于写入普通数据，不刷日志，需要时用动态调试打开 */
+        pr_debug("内核缓冲区内容：首字节的值是：%d，不操控 LED\n", sta);
+    }
+}
+
+/*************************************FIFO 环形缓冲区模式：开始***************************************************/
+/* 
+ * 环形缓冲区布局：tail 为读出位置，head 为写入位置，data_len 为环中现存字节数。
+ * 读空时读者睡在 rd_wq 上，写满时写者睡在 wr_wq 上；O_NONBLOCK 时直接返回 -EAGAIN。
+ * 数据拷贝最多分两段：先拷到缓冲区末尾，再从缓冲区开头拷剩余部分。
+ * 用户数据以 iov_iter 描述，readv/writev 的多个用户段一次系统调用搬完。
+ */
+
+/* 不可阻塞的请求：O_NONBLOCK 打开，或 io_uring/AIO 带 IOCB_NOWAIT 的试探性提交 */
+static bool fifo_nowait(struct kiocb *iocb)
+{
+    return (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+/* 
+ * @description : 从环中拷出数据到 to，推进 tail，须持有 data->lock
+ * @return      : 实际拷出的字节数；0 表示用户缓冲区出错
+ */
+static size_t fifo_copy_out(struct cdev_private_data_t *data, struct iov_iter *to)
+{
+    size_t cnt_read, first, copied;
+
+    cnt_read = min_t(size_t, iov_iter_count(to), data->data_len);
+    first    = min_t(size_t, cnt_read, data->buf_size - data->tail);
+    copied   = copy_to_iter(data->buffer + data->tail, first, to);
+    if (copied == first)
+        copied += copy_to_iter(data->buffer, cnt_read - first, to);
+
+    /* 用户缓冲区中途出错时，只消费已拷出的部分 */
+    data->tail = (data->tail + copied) % data->buf_size;
+    write_seqlock(&data->meta_lock);
+    data->data_len -= copied;
+    write_sequnlock(&data->meta_lock);
+    return copied;
+}
+
+/*************************************FIFO 异步读（kiocb）：开始***************************************************/
+/* 
+ * AIO 提交的读请求遇到空环时不占用线程等待：
+ * 请求挂到 aio_list 上立即返回 -EIOCBQUEUED；写者送来数据后调度 aio_work，
+ * 由工作线程借用提交者的地址空间把数据拷给用户，再调用 ki_complete 完成请求。
+ * 挂起的请求登记了取消回调，io_cancel/io_destroy/进程退出时以 -ECANCELED 完成，不会一直等写者。
+ * io_uring 的请求不挂起：它先以 IOCB_NOWAIT 提交，拿到 -EAGAIN 后在设备上挂 poll 等可读（可取消）；
+ * 落到 io-wq 的阻塞重试按同步读可中断地等，取消时给工作线程发信号即可打断。
+ */
+struct fifo_aio_req {
+    struct list_head  node;
+    bool              queued;  /* 还在 aio_list 上：完成工作或取消回调摘下时清零，受 aio_lock 保护 */
+    struct kiocb      *iocb;
+    struct iov_iter   to;      /* 复制出的迭代器：提交者栈上的原件在返回后即失效 */
+    const void        *iov;    /* dup_iter 分配的段数组，完成后释放 */
+    struct mm_struct  *mm;     /* 提交者的地址空间（iovec/ubuf 指向用户内存）；内核缓冲区（bvec/kvec）时为 NULL */
+    long              ret;
+};
+
+/* 挂起一个异步读，须持有 data->lock */
+static ssize_t fifo_aio_queue(struct cdev_private_data_t *data, struct kiocb *iocb, struct iov_iter *to)
+{
+    struct fifo_aio_req *req;
+
+    req = kzalloc(sizeof(*req), GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+    req->iov = chrdev_dup_iter(&req->to, to, GFP_KERNEL);
+    if (!req->iov) {
+        kfree(req);
+        return -ENOMEM;
+    }
+    req->iocb = iocb;
+    /* 指向用户内存的迭代器都要钉住提交者的地址空间，工作线程拷贝时借用它 */
+    if (chrdev_user_backed_iter(to)) {
+        req->mm = current->mm;
+        mmget(req->mm);
+    }
+    spin_lock_irq(&data->aio_lock);
+    list_add_tail(&req->node, &data->aio_list);
+    req->queued = true;
+    spin_unlock_irq(&data->aio_lock);
+    /* 入队之后才能被取消；持有 lock，完成工作此时不会取走它 */
+    iocb->private = req;
+    kiocb_set_cancel_fn(iocb, fifo_aio_cancel);
+
+    /* 环里还有数据（前面有排队的请求没轮完），确保完成工作会再跑一次 */
+    if (data->data_len > 0)
+        schedule_work(&data->aio_work);
+    return -EIOCBQUEUED;
+}
+
+/* 把还在队列上的请求摘到 aio_cancelled，须持有 aio_lock */
+static void fifo_aio_cancel_locked(struct cdev_private_data_t *data, struct fifo_aio_req *req)
+{
+    req->queued = false;
+    req->ret = -ECANCELED;
+    list_move_tail(&req->node, &data->aio_cancelled);
+}
+
+/* 
+ * AIO 取消回调：在 aio 上下文的 ctx_lock 自旋锁内、关着中断被调用，这时完成请求会在同一把锁上死锁，
+ * 所以只把请求摘下来，由完成工作在锁外以 -ECANCELED 完成；已被完成工作取走的请求照常完成。
+ */
+static int fifo_aio_cancel(struct kiocb *iocb)
+{
+    struct fifo_aio_req *req = iocb->private;
+    struct cdev_private_data_t *data = iocb->ki_filp->private_data;
+    unsigned long flags;
+    bool cancelled = false;
+
+    spin_lock_irqsave(&data->aio_lock, flags);
+    if (req->queued) {
+        fifo_aio_cancel_locked(data, req);
+        cancelled = true;
+    }
+    spin_unlock_irqrestore(&data->aio_lock, flags);
+    if (cancelled)
+        schedule_work(&data->aio_work);
+    return 0;
+}
+
+/* 取消 filp 挂起的全部异步读（filp 为 NULL 时取消所有的），由完成工作以 -ECANCELED 完成 */
+static void fifo_aio_flush(struct cdev_private_data_t *data, struct file *filp)
+{
+    struct fifo_aio_req *req, *tmp;
+    bool cancelled = false;
+
+    spin_lock_irq(&data->aio_lock);
+    list_for_each_entry_safe(req, tmp, &data->aio_list, node) {
+        if (filp && (req->iocb->ki_filp != filp))
+            continue;
+        fifo_aio_cancel_locked(data, req);
+        cancelled = true;
+    }
+    spin_unlock_irq(&data->aio_lock);
+    if (cancelled)
+        schedule_work(&data->aio_work);
+}
+
+static void fifo_aio_free(struct fifo_aio_req *req)
+{
+    if (req->mm)
+        mmput(req->mm);
+    kfree(req->iov);
+    kfree(req);
+}
+
+/* 完成工作：按排队顺序把环中数据分给挂起的异步读，连同已取消的请求一起在锁外逐个完成 */
+static void fifo_aio_work(struct work_struct *work)
+{
+    struct cdev_private_data_t *data = container_of(work, struct cdev_private_data_t, aio_work);
+    struct fifo_aio_req *req, *tmp;
+    size_t copied;
+    LIST_HEAD(done);
+
+    mutex_lock(&data->lock);
+    spin_lock_irq(&data->aio_lock);
+    list_splice_init(&data->aio_cancelled, &done);
+    while ((data->data_len > 0) && !list_empty(&data->aio_list)) {
+        req = list_first_entry(&data->aio_list, struct fifo_aio_req, node);
+        /* 先摘下再拷贝：拷贝可能缺页睡眠，不能持有 aio_lock；摘下后取消回调不再碰它 */
+        req->queued = false;
+        list_move_tail(&req->node, &done);
+        spin_unlock_irq(&data->aio_lock);
+        if (req->mm)
+            chrdev_use_mm(req->mm);
+        copied = fifo_copy_out(data, &req->to);
+        if (req->mm)
+            chrdev_unuse_mm(req->mm);
+        req->ret = copied ? (long)copied : -EFAULT;
+        spin_lock_irq(&data->aio_lock);
+    }
+    spin_unlock_irq(&data->aio_lock);
+    mutex_unlock(&data->lock);
+
+    if (list_empty(&done))
+        return;
+    wake_up_interruptible(&data->wr_wq);  /* 腾出了空间，唤醒等待的写者 */
+
+    list_for_each_entry_safe(req, tmp, &done, node) {
+        list_del(&req->node);
+        if (req->ret > 0)  /* 调用次数在提交时已计入，完成时只补上字节数 */
+            cdev_stat_add(data->stats, bytes_read, req->ret);
+        chrdev_ki_complete(req->iocb, req->ret);
+        fifo_aio_free(req);
+    }
+}
+/*************************************FIFO 异步读（kiocb）：结束***************************************************/
+
+static ssize_t fifo_read(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct cdev_private_data_t *data = iocb->ki_filp->private_data;
+    size_t copied;
+    ssize_t ret;
+
+    if (iov_iter_count(to) == 0)
+        return 0;
+
+    if (fifo_nowait(iocb)) {
+        if (!mutex_trylock(&data->lock))
+            return -EAGAIN;
+    } else if (mutex_lock_interruptible(&data->lock)) {
+        return -ERESTARTSYS;
+    }
+
+    /* AIO 请求：环空或前面已有排队者时挂起，保持先来先得；其余异步请求（io_uring）按同步读等待 */
+    if (!is_sync_kiocb(iocb) && !fifo_nowait(iocb) && chrdev_kiocb_is_aio(iocb) &&
+        ((data->data_len == 0) || !list_empty(&data->aio_list))) {
+        ret = fifo_aio_queue(data, iocb, to);
+        mutex_unlock(&data->lock);
+        return ret;
+    }
+
+    while (data->data_len == 0) {
+        mutex_unlock(&data->lock);
+        if (fifo_nowait(iocb))
+            return -EAGAIN;
+        if (wait_event_interruptible(data->rd_wq, READ_ONCE(data->data_len) > 0))
+            return -ERESTARTSYS;  /* 被信号打断 */
+        if (mutex_lock_interruptible(&data->lock))
+            return -ERESTARTSYS;
+    }
+
+    copied = fifo_copy_out(data, to);
+    mutex_unlock(&data->lock);
+    if (copied == 0) {
+        printk(KERN_ERR "内核 fifo_read：从内核复制数据到用户空间操作失败！\n");
+        return -EFAULT;
+    }
+
+    wake_up_interruptible(&data->wr_wq);  /* 腾出了空间，唤醒等待的写者 */
+    return copied;
+}
+
+static ssize_t fifo_write(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct cdev_private_data_t *data = iocb->ki_filp->private_data;
+    size_t cnt_write, first, copied;
+    bool kick_aio;
+    char sta;
+
+    if (iov_iter_count(from) == 0)
+        return 0;
+
+    if (fifo_nowait(iocb)) {
+        if (!mutex_trylock(&data->lock))
+            return -EAGAIN;
+    } else if (mutex_lock_interruptible(&data->lock)) {
+        return -ERESTARTSYS;
+    }
+
+    while (data->data_len == data->buf_size) {
+        mutex_unlock(&data->lock);
+        if (fifo_nowait(iocb))
+            return -EAGAIN;
+        if (wait_event_interruptible(data->wr_wq, READ_ONCE(data->data_len) < data->buf_size))
+            return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&data->lock))
+            return -ERESTARTSYS;
+    }
+
+    cnt_write = min_t(size_t, iov_iter_count(from), data->buf_size - data->data_len);
+    first     = min_t(size_t, cnt_write, data->buf_size - data->head);
+    copied    = copy_from_iter(data->buffer + data->head, first, from);
+    if (copied == first)
+        copied += copy_from_iter(data->buffer, cnt_write - first, from);
+    if (copied == 0) {
+        mutex_unlock(&data->lock);
+        printk(KERN_ERR "内核 fifo_write：从用户空间复制数据到内核空间的操作失败！\n");
+        return -EFAULT;
+    }
+
+    sta = data->buffer[data->head];  /* 本次写入的首字节控制 LED */
+    data->head = (data->head + copied) % data->buf_size;
+    write_seqlock(&data->meta_lock);
+    data->data_len += copied;
+    data->wr_gen++;
+    write_sequnlock(&data->meta_lock);
+    kick_aio = !list_empty(&data->aio_list);
+    mutex_unlock(&data->lock);
+
+    wake_up_interruptible(&data->rd_wq);  /* 有新数据了，唤醒等待的读者 */
+    if (kick_aio)
+        schedule_work(&data->aio_work);  /* 由生产者路径触发挂起的异步读完成 */
+    dev_led_ctrl(data, sta);
+    return copied;
+}
+
+/* 
+ * @description : poll/select/epoll 支持：FIFO 模式下按环中数据量报告可读可写；
+ *                平铺模式随时可读可写（与普通文件一致）。
+ */
+static __poll_t dev_poll(struct file *filp, poll_table *wait)
+{
+    struct cdev_private_data_t *data = filp->private_data;
+    __poll_t mask = 0;
+    size_t data_len;
+
+    if (buf_mode != BUF_MODE_FIFO)
+        return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &data->rd_wq, wait);
+    poll_wait(filp, &data->wr_wq, wait);
+
+    data_len = READ_ONCE(data->data_len);
+    if (data_len > 0)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (data_len < data->buf_size)
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
+}
+/*************************************FIFO 环形缓冲区模式：结束***************************************************/
+
+/*************************************区间锁：开始***************************************************/
+/* 
+ * 平铺/稀疏模式的并发控制：偏移按 1KB 一段划成条带，第 n 段归 stripes[n % LOCK_STRIPES] 管。
+ * 一次读写只锁住它覆盖到的条带（读共享、写独占），多个线程写互不重叠的区间时分别落在不同条带上，
+ * 可以在不同的核上并行，而不是被一把大锁串行化。
+ * 条带总是按序号从小到大加锁，任意两个区间之间不会死锁。
+ */
+
+/* 区间 [pos, pos + len) 覆盖到的条带，按位表示；跨满一轮就是全部条带 */
+static unsigned long stripe_mask(loff_t pos, size_t len)
+{
+    unsigned long first, last, mask = 0;
+
+    if (len == 0)
+        return 0;
+    first = pos >> LOCK_STRIPE_SHIFT;
+    last  = (pos + len - 1) >> LOCK_STRIPE_SHIFT;
+    if (last - first >= LOCK_STRIPES - 1)
+        return GENMASK(LOCK_STRIPES - 1, 0);
+    for (; first <= last; first++)
+        mask |= BIT(first % LOCK_STRIPES);
+    return mask;
+}
+
+static void range_unlock(struct cdev_private_data_t *data, unsigned long mask, bool write)
+{
+    unsigned int i;
+
+    for_each_set_bit(i, &mask, LOCK_STRIPES) {
+        if (write)
+            up_write(&data->stripes[i]);
+        else
+            up_read(&data->stripes[i]);
+    }
+}
+
+/* 
+ * @description : 锁住区间 [pos, pos + len) 覆盖到的条带；中途失败时已拿到的条带全部放掉。
+ * @param - write : true 独占（写），false 共享（读）
+ * @param - nowait: 不睡眠，拿不到锁返回 -EAGAIN（IOCB_NOWAIT）
+ * @return      : 0 成功，*maskp 为已锁住的条带；-EAGAIN；-EINTR 等锁时收到致命信号
+ */
+static int range_lock(struct cdev_private_data_t *data, loff_t pos, size_t len,
+                      bool write, bool nowait, unsigned long *maskp)
+{
+    unsigned long mask = stripe_mask(pos, len);
+    unsigned long held = 0;
+    unsigned int i;
+    int err = 0;
+
+    for_each_set_bit(i, &mask, LOCK_STRIPES) {
+        struct rw_semaphore *sem = &data->stripes[i];
+
+        if (nowait)
+            err = (write ? down_write_trylock(sem) : down_read_trylock(sem)) ? 0 : -EAGAIN;
+        else
+            err = write ? down_write_killable(sem) : down_read_killable(sem);
+        if (err) {
+            range_unlock(data, held, write);
+            return (err == -EAGAIN) ? err : -EINTR;
+        }
+        held |= BIT(i);
+    }
+    *maskp = held;
+    return 0;
+}
+/*************************************区间锁：结束***************************************************/
+
+/*************************************平铺模式的惰性清零：开始***************************************************/
+/* 
+ * 缓冲区按 CLEAR_CHUNK 分块，每块记下最近一次清零时的清空代数 chunk_gen[]。
+ * CLEAR_BUF 只把 clear_gen 加一、data_len 归零，O(1)，不管缓冲区多大；
+ * 代数对不上的块就是过期块：读出时当作全零（读者只共享持有条带，不动缓冲区），
+ * 写入前先整块清零再登记为当前代（写者独占持有该块的条带）。
+ * 映射到用户空间的字节没法拦截，所以 mmap 时把过期块一次补齐，映射期间的清空也照旧当场清零。
+ */
+static bool flat_chunk_live(struct cdev_private_data_t *data, loff_t pos)
+{
+    return data->chunk_gen[pos >> CLEAR_CHUNK_SHIFT] == data->clear_gen;
+}
+
+/* 把 [pos, pos + len) 覆盖到的过期块清零并登记为当前代。调用者须独占持有这些块的条带 */
+static void flat_chunks_revive(struct cdev_private_data_t *data, loff_t pos, size_t len)
+{
+    size_t idx, last;
+
+    if (len == 0)
+        return;
+    last = (pos + len - 1) >> CLEAR_CHUNK_SHIFT;
+    for (idx = pos >> CLEAR_CHUNK_SHIFT; idx <= last; idx++) {
+        if (data->chunk_gen[idx] == data->clear_gen)
+            continue;
+        memset(data->buffer + (idx << CLEAR_CHUNK_SHIFT), 0, CLEAR_CHUNK);
+        data->chunk_gen[idx] = data->clear_gen;
+    }
+}
+
+/* 
+ * @description : 拷出 [pos, pos + len) 到 to：连续的存活块一次拷贝，连续的过期块一次填零。
+ *                调用者须至少共享持有这些块的条带。
+ * @return      : 实际拷出的字节数；用户缓冲区中途出错时不足 len
+ */
+static size_t flat_copy_out(struct cdev_private_data_t *data, loff_t pos, size_t len, struct iov_iter *to)
+{
+    loff_t end = pos + len, run_end;
+    size_t done = 0, chunk, n;
+    bool live;
+
+    while (pos < end) {
+        live = flat_chunk_live(data, pos);
+        run_end = round_down(pos, CLEAR_CHUNK) + CLEAR_CHUNK;
+        while ((run_end < end) && (flat_chunk_live(data, run_end) == live))
+            run_end += CLEAR_CHUNK;
+        chunk = min(run_end, end) - pos;
+
+        n = live ? copy_to_iter(data->buffer + pos, chunk, to) : iov_iter_zero(chunk, to);
+        done += n;
+        pos  += n;
+        if (n < chunk)
+            break;
+    }
+    return done;
+}
+
+/* O(1) 清空：旧内容随代数一起作废。代数转满一圈时整块清零一次，免得很久没写过的块被误认为当前代 */
+static void flat_clear(struct cdev_private_data_t *data)
+{
+    size_t nchunks = PAGE_ALIGN(data->buf_size) >> CLEAR_CHUNK_SHIFT;
+
+    if (atomic_read(&data->mmap_count)) {  /* 映射出去的页用户空间直接看得到，只能当场清零 */
+        memset(data->buffer, 0, PAGE_ALIGN(data->buf_size));
+        return;
+    }
+    if (unlikely(++data->clear_gen == 0)) {
+        memset(data->buffer, 0, PAGE_ALIGN(data->buf_size));
+        memset(data->chunk_gen, 0, nchunks * sizeof(u32));
+    }
+}
+/*************************************平铺模式的惰性清零：结束***************************************************/
+
+/* 提示：read/write处理风格都是：二进制安全型！所以使用char类型代表单个字节，所有以单个字节的操作都是安全且兼容性强的 */
+static ssize_t flat_read(struct file *filp, struct iov_iter *to, loff_t *off) {
+
+    struct cdev_private_data_t *data = filp->private_data;
+    size_t cnt_read = 0;
+
+    /* 偏移越过有效数据时直接读尽：否则 data_len - *off 会下溢成超大值，越界读 */
+    if (*off < data->data_len)
+        cnt_read = min_t(size_t, iov_iter_count(to), data->data_len - *off); //min截短
+
+    if (cnt_read == 0) {
+        return 0;
+    }
+
+    /* 依次填满 readv 的各个用户段，返回实际拷贝的字节数；清空后还没写过的块读出为零 */
+    cnt_read = flat_copy_out(data, *off, cnt_read, to);
+    if (cnt_read == 0) {
+        printk(KERN_ERR "内核 chrdev_read：从内核复制数据到用户空间操作失败！\n");
+        return -EFAULT;
+    }
+
+    *off += cnt_read;
+    return cnt_read;
+}
+
+/* 提示：read/write处理风格都是：二进制安全型！所以使用char类型代表单个字节，所有以单个字节的操作都是安全且兼容性强的 */
+static ssize_t flat_write(struct file *filp, struct iov_iter *from, loff_t *off) {
+    struct cdev_private_data_t *data = filp->private_data;
+    size_t cnt_write;
+
+    /* 偏移越过缓冲区末尾（lseek 之后缓冲区被缩小也会这样）：否则 buf_size - *off 会下溢成超大值，越界写 */
+    if (*off >= data->buf_size)
+        return -ENOSPC;
+    cnt_write = min_t(size_t, iov_iter_count(from), data->buf_size - *off); //min，二进制安全，取小。OK。
+    if (cnt_write == 0) {
+        return -ENOSPC;
+    }
+    
+    /* 先补齐要写的过期块，再用 copy_from_iter 依次取出 writev 的各个用户段，返回实际拷贝的字节数 */
+    flat_chunks_revive(data, *off, cnt_write);
+    cnt_write = copy_from_iter(data->buffer + *off, cnt_write, from);
+    if (cnt_write == 0) {
+        printk(KERN_ERR "内核 chrdev_write：从用户空间复制数据到内核空间的操作失败！\n");
+        return -EFAULT;
+    }
+
+    /* 硬件LED灯控制部分: 提示，注意 data->buffer[0] 表示缓冲区第0位。而不是 (*off)；首块过期时读作 0 */
+    dev_led_ctrl(data, flat_chunk_live(data, 0) ? data->buffer[0] : 0);
+
+    *off += cnt_write;
+    data_len_extend(data, *off); //max，二进制安全，取大。OK。
+    return cnt_write;
+}
+
+/*************************************稀疏缓冲区模式：开始***************************************************/
+/* 
+ * 稀疏布局：buf_size 只是逻辑大小，数据按页存放在 data->pages（xarray，页号 -> 页）里。
+ * 页面在第一次写入时才分配并清零；读到空洞直接向用户填零，不分配也不访问任何页。
+ * 读写共享持有 resize_sem；释放页面（清空、缩小、销毁）须独占持有，读写过程中页面不会消失。
+ */
+
+/* 取出页号 index 对应的页，没有就分配一页补上。返回页指针；ERR_PTR(-ENOMEM) 分配失败 */
+static struct page *sparse_get_page(struct cdev_private_data_t *data, unsigned long index)
+{
+    struct page *page, *old;
+
+    page = xa_load(&data->pages, index);
+    if (page)
+        return page;
+
+    page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!page)
+        return ERR_PTR(-ENOMEM);
+    /* 并发写者只共享持有 resize_sem，可能同时给同一个空洞补页：只有一个能装进去 */
+    old = xa_cmpxchg(&data->pages, index, NULL, page, GFP_KERNEL);
+    if (old) {
+        __free_page(page);
+        if (xa_is_err(old))
+            return ERR_PTR(xa_err(old));
+        return old;
+    }
+    return page;
+}
+
+/* 
+ * @description : 在 start 处打洞直到缓冲区末尾：start 所在页的后半截清零，其后的页全部释放。
+ *                只遍历已分配的页，代价与写过的数据量成正比，与逻辑大小无关。调用者须独占持有 resize_sem。
+ */
+static void sparse_punch(struct cdev_private_data_t *data, size_t start)
+{
+    unsigned long index = start >> PAGE_SHIFT;
+    struct page *page;
+
+    if (offset_in_page(start)) {
+        page = xa_load(&data->pages, index);
+        if (page)
+            memset(page_address(page) + offset_in_page(start), 0, PAGE_SIZE - offset_in_page(start));
+        index++;
+    }
+    for (page = xa_find(&data->pages, &index, ULONG_MAX, XA_PRESENT); page;
+         page = xa_find_after(&data->pages, &index, ULONG_MAX, XA_PRESENT)) {
+        xa_erase(&data->pages, index);
+        __free_page(page);
+    }
+}
+
+/* 读出 pos 处的一个字节：空洞为 0 */
+static char sparse_byte(struct cdev_private_data_t *data, size_t pos)
+{
+    struct page *page = xa_load(&data->pages, pos >> PAGE_SHIFT);
+
+    return page ? ((char *)page_address(page))[offset_in_page(pos)] : 0;
+}
+
+static ssize_t sparse_read(struct file *filp, struct iov_iter *to, loff_t *off) {
+    struct cdev_private_data_t *data = filp->private_data;
+    size_t cnt_read = 0, done = 0;
+
+    if (*off < data->data_len)
+        cnt_read = min_t(size_t, iov_iter_count(to), data->data_len - *off);
+    if (cnt_read == 0) {
+        return 0;
+    }
+
+    /* 逐页搬运：有页就拷贝，空洞就填零 */
+    while (done < cnt_read) {
+        loff_t pos = *off + done;
+        size_t pg_off = offset_in_page(pos);
+        size_t chunk = min_t(size_t, cnt_read - done, PAGE_SIZE - pg_off);
+        struct page *page = xa_load(&data->pages, pos >> PAGE_SHIFT);
+        size_t n;
+
+        if (page)
+            n = copy_to_iter(page_address(page) + pg_off, chunk, to);
+        else
+            n = iov_iter_zero(chunk, to);
+        done += n;
+        if (n < chunk)
+            break;
+    }
+    if (done == 0) {
+        printk(KERN_ERR "内核 chrdev_read：从内核复制数据到用户空间操作失败！\n");
+        return -EFAULT;
+    }
+
+    *off += done;
+    return done;
+}
+
+static ssize_t sparse_write(struct file *filp, struct iov_iter *from, loff_t *off) {
+    struct cdev_private_data_t *data = filp->private_data;
+    size_t cnt_write = 0, done = 0;
+    int err = -EFAULT;
+
+    if (*off < data->buf_size)
+        cnt_write = min_t(size_t, iov_iter_count(from), data->buf_size - *off);
+    if (cnt_write == 0) {
+        return -ENOSPC;
+    }
+
+    /* 逐页搬运：写到空洞时才分配该页 */
+    while (done < cnt_write) {
+        loff_t pos = *off + done;
+        size_t pg_off = offset_in_page(pos);
+        size_t chunk = min_t(size_t, cnt_write - done, PAGE_SIZE - pg_off);
+        struct page *page = sparse_get_page(data, pos >> PAGE_SHIFT);
+        size_t n;
+
+        if (IS_ERR(page)) {
+            err = PTR_ERR(page);
+            break;
+        }
+        n = copy_from_iter(page_address(page) + pg_off, chunk, from);
+        done += n;
+        if (n < chunk)
+            break;
+    }
+    if (done == 0) {
+        printk(KERN_ERR "内核 chrdev_write：写入稀疏缓冲区失败！\n");
+        return err;
+    }
+
+    dev_led_ctrl(data, sparse_byte(data, 0));  /* 与平铺模式一致：首字节控制 LED */
+
+    *off += done;
+    data_len_extend(data, *off);
+    return done;
+}
+/*************************************稀疏缓冲区模式：结束***************************************************/
+
+/*************************************RCU 快照模式：开始***************************************************/
+/* 
+ * 快照布局：data->snap 指向当前发布的版本（struct cdev_snap_t），版本一经发布内容就不再改变。
+ * 写者持 data->lock 复制出新版本、在新版本上改、再用 rcu_assign_pointer 一次换上；
+ * 读者不拿任何锁：在 RCU 读临界区里取指针并加引用，出了临界区再拷贝（拷贝可能缺页睡眠）。
+ * 旧版本的最后一个引用放掉后经 call_rcu 释放：取指针到加引用之间的读者不会摸到已释放的内存。
+ * 于是读者总是读到某一个完整版本，不会读到清空或写入进行到一半的数据；清空只是发布一个空版本，O(1)。
+ */
+static struct cdev_snap_t *snap_alloc(size_t cap)
+{
+    struct cdev_snap_t *snap;
+
+    snap = kvmalloc(struct_size(snap, data, cap), GFP_KERNEL);
+    if (!snap)
+        return NULL;
+    kref_init(&snap->ref);  /* 这个引用归发布者，替换下来时放掉 */
+    snap->len = 0;
+    return snap;
+}
+
+static void snap_free_rcu(struct rcu_head *rcu)
+{
+    kvfree(container_of(rcu, struct cdev_snap_t, rcu));
+}
+
+static void snap_release(struct kref *ref)
+{
+    struct cdev_snap_t *snap = container_of(ref, struct cdev_snap_t, ref);
+
+    call_rcu(&snap->rcu, snap_free_rcu);
+}
+
+static void snap_put(struct cdev_snap_t *snap)
+{
+    kref_put(&snap->ref, snap_release);
+}
+
+/* 取当前版本并加引用：引用已归零说明它刚被换下，重取一次就是新版本 */
+static struct cdev_snap_t *snap_get(struct cdev_private_data_t *data)
+{
+    struct cdev_snap_t *snap;
+
+    rcu_read_lock();
+    do {
+        snap = rcu_dereference(data->snap);
+    } while (!kref_get_unless_zero(&snap->ref));
+    rcu_read_unlock();
+    return snap;
+}
+
+/* 发布新版本并放掉旧版本的发布引用；调用者持 data->lock */
+static void snap_publish(struct cdev_private_data_t *data, struct cdev_snap_t *snap)
+{
+    struct cdev_snap_t *old = rcu_dereference_protected(data->snap, lockdep_is_held(&data->lock));
+
+    rcu_assign_pointer(data->snap, snap);
+    write_seqlock(&data->meta_lock);
+    data->data_len = snap->len;
+    data->wr_gen++;
+    write_sequnlock(&data->meta_lock);
+    snap_put(old);
+}
+
+static ssize_t snap_read(struct file *filp, struct iov_iter *to, loff_t *off) {
+    struct cdev_private_data_t *data = filp->private_data;
+    struct cdev_snap_t *snap = snap_get(data);
+    size_t cnt_read = 0;
+
+    if (*off < snap->len)
+        cnt_read = min_t(size_t, iov_iter_count(to), snap->len - *off);
+    if (cnt_read == 0) {
+        snap_put(snap);
+        return 0;
+    }
+
+    cnt_read = copy_to_iter(snap->data + *off, cnt_read, to);
+    snap_put(snap);
+    if (cnt_read == 0) {
+        printk(KERN_ERR "内核 chrdev_read：从内核复制数据到用户空间操作失败！\n");
+        return -EFAULT;
+    }
+
+    *off += cnt_read;
+    return cnt_read;
+}
+
+static ssize_t snap_write(struct kiocb *iocb, struct iov_iter *from) {
+    struct cdev_private_data_t *data = iocb->ki_filp->private_data;
+    struct cdev_snap_t *old, *snap;
+    loff_t *off = &iocb->ki_pos;
+    size_t cnt_write, copied;
+    char sta;
+
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (!mutex_trylock(&data->lock))
+            return -EAGAIN;
+    } else if (mutex_lock_interruptible(&data->lock)) {
+        return -ERESTARTSYS;
+    }
+
+    if (*off >= data->buf_size) {
+        mutex_unlock(&data->lock);
+        return -ENOSPC;
+    }
+    cnt_write = min_t(size_t, iov_iter_count(from), data->buf_size - *off);
+
+    /* 复制出新版本：旧数据 + 旧末尾到写入点之间补零 + 本次写入 */
+    snap = snap_alloc(data->buf_size);
+    if (!snap) {
+        mutex_unlock(&data->lock);
+        return -ENOMEM;
+    }
+    old = rcu_dereference_protected(data->snap, lockdep_is_held(&data->lock));
+    memcpy(snap->data, old->data, old->len);  /* 调整大小不允许小于有效数据，旧数据一定放得下 */
+    if (*off > old->len)
+        memset(snap->data + old->len, 0, *off - old->len);
+    copied = copy_from_iter(snap->data + *off, cnt_write, from);
+    if (copied == 0) {
+        mutex_unlock(&data->lock);
+        kvfree(snap);  /* 还没发布，没有读者见过它 */
+        printk(KERN_ERR "内核 chrdev_write：从用户空间复制数据到内核空间的操作失败！\n");
+        return -EFAULT;
+    }
+    snap->len = max_t(size_t, old->len, *off + copied);
+    sta = snap->data[0];
+    snap_publish(data, snap);
+    mutex_unlock(&data->lock);
+
+    dev_led_ctrl(data, sta);
+    *off += copied;
+    return copied;
+}
+
+/* 清空：发布一个空版本，与缓冲区大小无关；正在读旧版本的读者照常读完 */
+static int snap_clear(struct cdev_private_data_t *data, bool nowait)
+{
+    struct cdev_snap_t *snap = snap_alloc(0);
+
+    if (!snap)
+        return -ENOMEM;
+    if (nowait) {
+        if (!mutex_trylock(&data->lock)) {
+            kvfree(snap);
+            return -EAGAIN;
+        }
+    } else {
+        mutex_lock(&data->lock);
+    }
+    snap_publish(data, snap);
+    mutex_unlock(&data->lock);
+    return 0;
+}
+/*************************************RCU 快照模式：结束***************************************************/
+
+/*************************************每 CPU 暂存模式：开始***************************************************/
+/* 
+ * 每个 CPU 一个记录环（struct cdev_pcpu_ring_t，alloc_percpu 分配）：write 把一条记录追加到当前 CPU 的环里，
+ * 高频生产者之间没有任何共享的写入，缓存行不会在核之间来回迁移。
+ * read 由合并读者完成：每次从各环尾部挑时间戳最小的一条取走，读出的是按时间排序的归并流，记录不会被拆开。
+ * 环写满时覆盖最旧的记录（与 ftrace 的每 CPU 缓冲区一样，生产者从不阻塞），被覆盖的条数计入 dropped。
+ * CPU 热插拔：槽位数组在 CPU 上线时才按其本地内存节点分配，不在的 CPU 不占内存；
+ * CPU 下线时环保留在原处，合并读者遍历全部 possible CPU，下线前留下的记录照样按时间读出，重新上线后继续使用。
+ */
+static int pcpu_ring_alloc(struct cdev_private_data_t *data, unsigned int cpu)
+{
+    struct cdev_pcpu_ring_t *ring = per_cpu_ptr(data->pcpu, cpu);
+    struct cdev_pcpu_rec_t *recs;
+
+    if (ring->recs)  /* 下线又上线：沿用原来的环和其中的记录 */
+        return 0;
+    recs = kvmalloc_node(PCPU_RING_SLOTS * sizeof(*recs), GFP_KERNEL, cpu_to_node(cpu));
+    if (!recs)
+        return -ENOMEM;
+    spin_lock(&ring->lock);
+    ring->recs = recs;
+    spin_unlock(&ring->lock);
+    return 0;
+}
+
+/* CPU 上线回调：为每个实例分配该 CPU 的槽位数组 */
+static int pcpu_cpu_online(unsigned int cpu, struct hlist_node *node)
+{
+    struct cdev_private_data_t *data = hlist_entry(node, struct cdev_private_data_t, cpuhp_node);
+
+    return pcpu_ring_alloc(data, cpu);
+}
+
+static int pcpu_data_init(struct cdev_private_data_t *data)
+{
+    struct cdev_pcpu_ring_t *ring;
+    unsigned int cpu;
+
+    data->pcpu = alloc_percpu(struct cdev_pcpu_ring_t);
+    if (!data->pcpu)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(data->pcpu, cpu);
+        spin_lock_init(&ring->lock);
+        ring->head = ring->tail = 0;
+        ring->dropped = 0;
+        ring->recs = NULL;
+    }
+    /* 登记实例：对当前在线的每个 CPU 调一次上线回调，之后上线的 CPU 由热插拔机制回调 */
+    if (cpuhp_state_add_instance(pcpu_hp_state, &data->cpuhp_node)) {
+        for_each_possible_cpu(cpu)
+            kvfree(per_cpu_ptr(data->pcpu, cpu)->recs);
+        free_percpu(data->pcpu);
+        data->pcpu = NULL;
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void pcpu_data_free(struct cdev_private_data_t *data)
+{
+    unsigned int cpu;
+
+    cpuhp_state_remove_instance_nocalls(pcpu_hp_state, &data->cpuhp_node);
+    for_each_possible_cpu(cpu)
+        kvfree(per_cpu_ptr(data->pcpu, cpu)->recs);
+    free_percpu(data->pcpu);
+    data->pcpu = NULL;
+}
+
+/* 环中现存记录的总字节数：只在查询时逐 CPU 求和，写路径不维护任何共享计数 */
+static size_t pcpu_data_len(struct cdev_private_data_t *data)
+{
+    struct cdev_pcpu_ring_t *ring;
+    unsigned int cpu, seq;
+    size_t len = 0;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(data->pcpu, cpu);
+        spin_lock(&ring->lock);
+        for (seq = ring->tail; seq != ring->head; seq++)
+            len += ring->recs[seq % PCPU_RING_SLOTS].len;
+        spin_unlock(&ring->lock);
+    }
+    return len;
+}
+
+static unsigned long pcpu_dropped(struct cdev_private_data_t *data)
+{
+    unsigned long dropped = 0;
+    unsigned int cpu;
+
+    for_each_possible_cpu(cpu)
+        dropped += READ_ONCE(per_cpu_ptr(data->pcpu, cpu)->dropped);
+    return dropped;
+}
+
+static ssize_t pcpu_write(struct kiocb *iocb, struct iov_iter *from) {
+    struct cdev_private_data_t *data = iocb->ki_filp->private_data;
+    struct cdev_pcpu_ring_t *ring;
+    struct cdev_pcpu_rec_t *rec;
+    char stage[PCPU_REC_MAX];
+    size_t len = min_t(size_t, iov_iter_count(from), PCPU_REC_MAX);
+    int err = 0;
+
+    if (len == 0)
+        return 0;
+    /* 先拷到栈上：下面关抢占持自旋锁，不能再碰可能缺页的用户内存 */
+    if (!copy_from_iter_full(stage, len, from)) {
+        printk(KERN_ERR "内核 chrdev_write：从用户空间复制数据到内核空间的操作失败！\n");
+        return -EFAULT;
+    }
+
+    ring = get_cpu_ptr(data->pcpu);
+    spin_lock(&ring->lock);
+    if (unlikely(!ring->recs)) {
+        err = -ENOMEM;
+    } else {
+        if (ring->head - ring->tail == PCPU_RING_SLOTS) {  /* 写满：覆盖最旧的一条 */
+            ring->tail++;
+            ring->dropped++;
+        }
+        rec = &ring->recs[ring->head % PCPU_RING_SLOTS];
+        rec->ts  = ktime_get_ns();
+        rec->len = len;
+        memcpy(rec->data, stage, len);
+        ring->head++;
+    }
+    spin_unlock(&ring->lock);
+    put_cpu_ptr(data->pcpu);
+    if (err)
+        return err;
+
+    dev_led_ctrl(data, stage[0]);  /* 每条记录的首字节控制 LED */
+    return len;
+}
+
+/* 
+ * @description : 合并读：反复从各 CPU 环尾挑时间戳最小的记录（相同时取 CPU 号小的），
+ *                直到环都空了或用户缓冲区放不下下一条完整记录。合并读者之间用 data->lock 串行，
+ *                挑出的记录在取走前不会被别的读者拿走；写者只往环头追加（覆盖时才动尾部，重新挑即可）。
+ * @return      : 读出的字节数；0 没有记录；-EINVAL 用户缓冲区连一条记录都放不下
+ */
+static ssize_t pcpu_read(struct kiocb *iocb, struct iov_iter *to) {
+    struct cdev_private_data_t *data = iocb->ki_filp->private_data;
+    struct cdev_pcpu_ring_t *ring;
+    struct cdev_pcpu_rec_t *rec;
+    char stage[PCPU_REC_MAX];
+    unsigned int cpu, len;
+    ssize_t done = 0;
+    int best;
+    u64 best_ts;
+
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (!mutex_trylock(&data->lock))
+            return -EAGAIN;
+    } else if (mutex_lock_interruptible(&data->lock)) {
+        return -ERESTARTSYS;
+    }
+
+    while (iov_iter_count(to)) {
+        best = -1;
+        best_ts = U64_MAX;
+        for_each_possible_cpu(cpu) {
+            ring = per_cpu_ptr(data->pcpu, cpu);
+            spin_lock(&ring->lock);
+            if ((ring->head != ring->tail) && (ring->recs[ring->tail % PCPU_RING_SLOTS].ts < best_ts)) {
+                best_ts = ring->recs[ring->tail % PCPU_RING_SLOTS].ts;
+                best = cpu;
+            }
+            spin_unlock(&ring->lock);
+        }
+        if (best < 0)
+            break;
+
+        ring = per_cpu_ptr(data->pcpu, best);
+        spin_lock(&ring->lock);
+        rec = &ring->recs[ring->tail % PCPU_RING_SLOTS];
+        if ((ring->head == ring->tail) || (rec->ts != best_ts)) {  /* 挑完之后被覆盖了：重新挑 */
+            spin_unlock(&ring->lock);
+            continue;
+        }
+        len = rec->len;
+        if (len > iov_iter_count(to)) {  /* 不拆记录 */
+            spin_unlock(&ring->lock);
+            if (done == 0)
+                done = -EINVAL;
+            break;
+        }
+        memcpy(stage, rec->data, len);
+        ring->tail++;
+        spin_unlock(&ring->lock);
+
+        if (copy_to_iter(stage, len, to) != len) {
+            if (done == 0)
+                done = -EFAULT;
+            break;
+        }
+        done += len;
+    }
+    mutex_unlock(&data->lock);
+    return done;
+}
+
+/* 清空：丢弃各 CPU 环中的全部记录 */
+static int pcpu_clear(struct cdev_private_data_t *data, bool nowait)
+{
+    struct cdev_pcpu_ring_t *ring;
+    unsigned int cpu;
+
+    if (nowait) {
+        if (!mutex_trylock(&data->lock))
+            return -EAGAIN;
+    } else {
+        mutex_lock(&data->lock);
+    }
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(data->pcpu, cpu);
+        spin_lock(&ring->lock);
+        ring->tail = ring->head;
+        spin_unlock(&ring->lock);
+    }
+    mutex_unlock(&data->lock);
+    return 0;
+}
+/*************************************每 CPU 暂存模式：结束***************************************************/
+
+/* 
+ * @description : 平铺/稀疏模式的读写入口：先共享持有 resize_sem（读写之间互不阻塞，只与调整大小互斥），
+ *                再锁住本次访问覆盖到的条带，写互不重叠区间的线程可以并行。
+ * @param - write : true 写，false 读
+ */
+static ssize_t flat_rw_locked(struct kiocb *iocb, struct iov_iter *iter, bool write)
+{
+    struct file *filp = iocb->ki_filp;
+    struct cdev_private_data_t *data = filp->private_data;
+    bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+    unsigned long mask;
+    size_t len = 0;
+    ssize_t ret;
+
+    if (nowait) {
+        if (!down_read_trylock(&data->resize_sem))
+            return -EAGAIN;
+    } else if (down_read_killable(&data->resize_sem)) {
+        return -EINTR;
+    }
+
+    /* 持有 resize_sem 期间 buf_size 不会变，越过末尾的部分本来也不会被访问 */
+    if (iocb->ki_pos < data->buf_size)
+        len = min_t(size_t, iov_iter_count(iter), data->buf_size - iocb->ki_pos);
+    ret = range_lock(data, iocb->ki_pos, len, write, nowait, &mask);
+    if (ret)
+        goto out;
+
+    if (buf_mode == BUF_MODE_SPARSE)
+        ret = write ? sparse_write(filp, iter, &iocb->ki_pos) : sparse_read(filp, iter, &iocb->ki_pos);
+    else
+        ret = write ? flat_write(filp, iter, &iocb->ki_pos) : flat_read(filp, iter, &iocb->ki_pos);
+    range_unlock(data, mask, write);
+out:
+    up_read(&data->resize_sem);
+    return ret;
+}
+
+/* 
+ * 按缓冲区模式分派读写，并累计所属次设备的统计。
+ * 只提供 read_iter/write_iter：read/write 由内核包装成单段 iov_iter 调进来，
+ * readv/writev 则把全部用户段一次交给驱动，一次系统调用完成分散/聚集传输。
+ */
+static ssize_t dev_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct file *filp = iocb->ki_filp;
+    struct cdev_private_data_t *data = filp->private_data;
+    loff_t pos = iocb->ki_pos;
+    size_t len = iov_iter_count(to);
+    u64 t0 = cdev_stat_begin();
+    ssize_t ret;
+
+    if (buf_mode == BUF_MODE_FIFO)
+        ret = fifo_read(iocb, to);
+    else if (buf_mode == BUF_MODE_SNAPSHOT)
+        ret = snap_read(filp, to, &iocb->ki_pos);  /* 不拿任何锁 */
+    else if (buf_mode == BUF_MODE_PERCPU)
+        ret = pcpu_read(iocb, to);
+    else
+        ret = flat_rw_locked(iocb, to, false);
+    trace_chrdev_read(pos, len, ret);
+    cdev_stat_op(data->stats, CDEV_OP_READ, ret, t0);
+    return ret;
+}
+
+static ssize_t dev_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct file *filp = iocb->ki_filp;
+    struct cdev_private_data_t *data = filp->private_data;
+    loff_t pos = iocb->ki_pos;
+    size_t len = iov_iter_count(from);
+    u64 t0 = cdev_stat_begin();
+    ssize_t ret;
+
+    if (buf_mode == BUF_MODE_FIFO)
+        ret = fifo_write(iocb, from);
+    else if (buf_mode == BUF_MODE_SNAPSHOT)
+        ret = snap_write(iocb, from);
+    else if (buf_mode == BUF_MODE_PERCPU)
+        ret = pcpu_write(iocb, from);
+    else
+        ret = flat_rw_locked(iocb, from, true);
+    trace_chrdev_write(pos, len, ret);
+    cdev_stat_op(data->stats, CDEV_OP_WRITE, ret, t0);
+    return ret;
+}
+
+/* 
+ * @description : 调整缓冲区大小，保留现有数据。新缓冲区分配好、数据搬过去之后再替换，
+ *                失败时原缓冲区原封不动。FIFO 模式下把环中数据搬到新缓冲区开头，展开成连续的一段。
+ *                调用者须独占持有 resize_sem：平铺模式的读写都共享持有它，替换期间看不到半新半旧的缓冲区。
+ * @param - size: 新的大小（字节）
+ * @return      : 0 成功；-EINVAL 大小越界或小于现有数据量；-EBUSY 缓冲区正被 mmap；-ENOMEM 分配失败
+ */
+static int cdev_data_resize(struct cdev_private_data_t *data, size_t size)
+{
+    char *new_buf, *old_buf;
+    u32 *new_gen = NULL, *old_gen;
+    size_t first, idx;
+
+    if ((size == 0) || (size > buf_size_max()))
+        return -EINVAL;
+    if (buf_mode == BUF_MODE_PERCPU)  /* 记录环的大小是固定的 */
+        return -EINVAL;
+
+    /* 稀疏模式只改逻辑大小，不搬数据；缩小时释放新边界之外的残留页，再扩大时那里仍是空洞 */
+    if (buf_mode == BUF_MODE_SPARSE) {
+        if (size < data->data_len)
+            return -EINVAL;
+        if (size < data->buf_size)
+            sparse_punch(data, size);
+        write_seqlock(&data->meta_lock);
+        data->buf_size = size;
+        data->wr_gen++;
+        write_sequnlock(&data->meta_lock);
+        printk(KERN_INFO "ioctl: 缓冲区大小已调整为 %zu 字节\n", size);
+        return 0;
+    }
+
+    /* 快照模式的 buf_size 只是下一个版本的容量：已发布的版本不受影响，读者照常读 */
+    if (buf_mode == BUF_MODE_SNAPSHOT) {
+        mutex_lock(&data->lock);
+        if (size < data->data_len) {
+            mutex_unlock(&data->lock);
+            return -EINVAL;
+        }
+        write_seqlock(&data->meta_lock);
+        data->buf_size = size;
+        data->wr_gen++;
+        write_sequnlock(&data->meta_lock);
+        mutex_unlock(&data->lock);
+        printk(KERN_INFO "ioctl: 缓冲区大小已调整为 %zu 字节\n", size);
+        return 0;
+    }
+
+    /* 映射出去的是旧缓冲区的物理页，替换后用户空间会继续访问已释放的内存 */
+    if (atomic_read(&data->mmap_count))
+        return -EBUSY;
+
+    /* 整页分配：几 MB 的缓冲区也不需要高阶连续物理页。不清零，平铺模式靠块代数把没搬过去的块标成过期 */
+    new_buf = vmalloc(PAGE_ALIGN(size));
+    if (!new_buf)
+        return -ENOMEM;
+    if (buf_mode == BUF_MODE_FLAT) {
+        new_gen = kvcalloc(PAGE_ALIGN(size) >> CLEAR_CHUNK_SHIFT, sizeof(u32), GFP_KERNEL);
+        if (!new_gen) {
+            vfree(new_buf);
+            return -ENOMEM;
+        }
+    }
+
+    /* FIFO 模式的读写路径只持有 data->lock，不经过 resize_sem */
+    mutex_lock(&data->lock);
+    if (size < data->data_len) {  /* 放不下现有数据：拒绝，而不是截掉 */
+        mutex_unlock(&data->lock);
+        vfree(new_buf);
+        kvfree(new_gen);
+        return -EINVAL;
+    }
+    if (buf_mode == BUF_MODE_FIFO) {
+        first = min_t(size_t, data->data_len, data->buf_size - data->tail);
+        memcpy(new_buf, data->buffer + data->tail, first);
+        memcpy(new_buf + first, data->buffer, data->data_len - first);
+        data->tail = 0;
+        data->head = data->data_len % size;
+    } else {
+        /* 只搬有效数据覆盖到的存活块（新缓冲区的当前代为 1）；过期块搬过去仍是过期块，照旧读作全零 */
+        for (idx = 0; idx < DIV_ROUND_UP(data->data_len, CLEAR_CHUNK); idx++) {
+            if (data->chunk_gen[idx] != data->clear_gen)
+                continue;
+            memcpy(new_buf + (idx << CLEAR_CHUNK_SHIFT), data->buffer + (idx << CLEAR_CHUNK_SHIFT), CLEAR_CHUNK);
+            new_gen[idx] = 1;
+        }
+        /* 最后一块里有效数据之后的部分清零，与原先只搬 data_len 字节的结果一致 */
+        if ((data->data_len & (CLEAR_CHUNK - 1)) && new_gen[data->data_len >> CLEAR_CHUNK_SHIFT])
+            memset(new_buf + data->data_len, 0, round_up(data->data_len, CLEAR_CHUNK) - data->data_len);
+        data->clear_gen = 1;
+    }
+    old_buf = data->buffer;
+    data->buffer = new_buf;
+    old_gen = data->chunk_gen;
+    data->chunk_gen = new_gen;
+    write_seqlock(&data->meta_lock);
+    data->buf_size = size;
+    data->wr_gen++;
+    write_sequnlock(&data->meta_lock);
+    mutex_unlock(&data->lock);
+
+    vfree(old_buf);
+    kvfree(old_gen);
+    if (buf_mode == BUF_MODE_FIFO)
+        wake_up_interruptible(&data->wr_wq);  /* 扩容后可能有了空间 */
+    printk(KERN_INFO "ioctl: 缓冲区大小已调整为 %zu 字节\n", size);
+    return 0;
+}
+
+/* 调整大小要换掉整个缓冲区，稀疏模式的清空要释放页面：须独占 resize_sem，等正在进行的读写和控制命令结束 */
+static bool chrdev_ctl_excl(unsigned int cmd)
+{
+    return (cmd == RESIZE_BUF) || ((cmd == CLEAR_BUF) && (buf_mode == BUF_MODE_SPARSE));
+}
+
+/* 
+ * @description : 执行一条控制命令，调用者已持有 resize_sem：chrdev_ctl_excl 为真的命令须独占持有，
+ *                其余共享持有即可（独占持有时也能执行）。单条命令和批量命令共用。
+ * @return      : 0 成功；负数错误码
+ */
+static int chrdev_ctl_locked(struct cdev_private_data_t *data, unsigned int cmd, int *val, bool nowait)
+{
+    struct chrdev_meta meta;
+    unsigned long mask;
+    int ret = 0;
+
+    if (chrdev_ctl_excl(cmd)) {
+        if (cmd == RESIZE_BUF)
+            return cdev_data_resize(data, *val);
+        sparse_punch(data, 0);  /* 只释放写过的页：O(已分配页数)，与逻辑大小无关 */
+        write_seqlock(&data->meta_lock);
+        data->data_len = 0;
+        data->wr_gen++;
+        write_sequnlock(&data->meta_lock);
+        return 0;
+    }
+
+    switch (cmd) {
+        case GET_BUF_SIZE:
+        case GET_DATA_LEN:
+            cdev_meta_snapshot(data, &meta);
+            if (buf_mode == BUF_MODE_PERCPU)  /* 写路径不维护共享的 data_len，查询时现算 */
+                meta.data_len = pcpu_data_len(data);
+            *val = (cmd == GET_BUF_SIZE) ? meta.buf_size : meta.data_len;
+            break;
+
+        case LED_GET:  /* 读影子，不访问硬件 */
+            *val = led_get();
+            break;
+
+        case LED_SET:  /* 直接开关灯，不经过缓冲区 */
+            if ((*val != LEDON) && (*val != LEDOFF)) {
+                ret = -EINVAL;
+                break;
+            }
+            dev_led_ctrl(data, *val);
+            break;
+
+        case CLEAR_BUF:  /* 清除缓冲区 */
+            if (buf_mode == BUF_MODE_FIFO) {
+                /* 环形缓冲区只需复位读写位置，并唤醒等待空间的写者 */
+                if (nowait) {
+                    if (!mutex_trylock(&data->lock)) {
+                        ret = -EAGAIN;
+                        break;
+                    }
+                } else {
+                    mutex_lock(&data->lock);
+                }
+                data->head = data->tail = 0;
+                write_seqlock(&data->meta_lock);
+                data->data_len = 0;
+                data->wr_gen++;
+                write_sequnlock(&data->meta_lock);
+                mutex_unlock(&data->lock);
+                wake_up_interruptible(&data->wr_wq);
+                break;
+            }
+            if (buf_mode == BUF_MODE_PERCPU) {
+                ret = pcpu_clear(data, nowait);
+                break;
+            }
+            if (buf_mode == BUF_MODE_SNAPSHOT) {
+                ret = snap_clear(data, nowait);
+                break;
+            }
+            /* 锁住全部条带：等正在进行的读写结束，清空过程中不会有人写进来 */
+            ret = range_lock(data, 0, data->buf_size, true, nowait, &mask);
+            if (ret)
+                break;
+            write_seqlock(&data->meta_lock);
+            data->data_len = 0;
+            data->wr_gen++;
+            write_sequnlock(&data->meta_lock);
+            flat_clear(data);
+            range_unlock(data, mask, true);
+            break;
+
+        case MAPLEAY_UPDATE_DAT_LEN:  /* 自定义：更新有效数据长度 */
+            /* mmap 用户直接改写缓冲区后，靠此命令登记有效长度，必须校验边界 */
+            if ((buf_mode == BUF_MODE_FIFO) ||  /* 环中数据量由读写自行维护，不允许外部改写 */
+                (buf_mode == BUF_MODE_SNAPSHOT) ||  /* 已发布的版本不可修改 */
+                (buf_mode == BUF_MODE_PERCPU) ||    /* 记录长度由各 CPU 环自行维护 */
+                (*val < 0) || (*val > data->buf_size)) {
+                ret = -EINVAL;
+                break;
+            }
+            write_seqlock(&data->meta_lock);
+            data->data_len = *val;  //设置有效数据长度
+            data->wr_gen++;
+            write_sequnlock(&data->meta_lock);
+            *val = 12345678;        //特殊数字 仅用来测试 _IORW 的返回方向。
+            break;
+        case PRINT_BUF_DATA:
+            /* 只打一行概要：逐字节 printk 会刷屏并拖住控制台，内容改由 debugfs 的 hexdump/raw 流式读取 */
+            printk(KERN_INFO "内核操作：缓冲区有效数据 %zu 字节，内容见 <debugfs>/mapleay-chrdev/<设备名>/hexdump 或 raw%s\n",
+                   (buf_mode == BUF_MODE_PERCPU) ? pcpu_data_len(data) : data->data_len,
+                   data->per_open ? "（本会话的独立缓冲区不在其中）" : "");
+            break;
+
+        default:
+            ret = -ENOTTY;
+            break;
+    }
+    return ret;
+}
+
+/* 
+ * @description : 控制命令的执行体，与传输方式无关：ioctl 和 io_uring uring_cmd 共用。
+ *                参数和结果都是内核空间的 int，由调用方负责与用户空间交换。
+ * @param - cmd : ioctl 命令号（已校验过魔数和序号）
+ * @param - val : 写方向命令的输入参数；读方向命令的输出结果
+ * @param - nowait : 调用方不能睡眠（io_uring 的内联提交），需要等锁的命令返回 -EAGAIN
+ * @return      : 0 成功；负数错误码
+ */
+static int chrdev_ctl_exec(struct cdev_private_data_t *data, unsigned int cmd, int *val, bool nowait)
+{
+    int ret;
+
+    if (chrdev_ctl_excl(cmd)) {
+        if (nowait)  /* 分配、搬运和释放都可能睡眠 */
+            return -EAGAIN;
+        if (down_write_killable(&data->resize_sem))
+            return -EINTR;
+        ret = chrdev_ctl_locked(data, cmd, val, nowait);
+        up_write(&data->resize_sem);
+        return ret;
+    }
+
+    /* 元数据查询读 seqlock 快照、LED 查询读影子：不拿 resize_sem 也不拿条带锁，监控方高频轮询不会拖慢读写 */
+    if ((cmd == GET_BUF_SIZE) || (cmd == GET_DATA_LEN) || (cmd == LED_GET))
+        return chrdev_ctl_locked(data, cmd, val, nowait);
+
+    /* 其余命令都要访问 buffer/buf_size，共享持有即可 */
+    if (nowait) {
+        if (!down_read_trylock(&data->resize_sem))
+            return -EAGAIN;
+    } else if (down_read_killable(&data->resize_sem)) {
+        return -EINTR;
+    }
+    ret = chrdev_ctl_locked(data, cmd, val, nowait);
+    up_read(&data->resize_sem);
+    return ret;
+}
+
+/* 
+ * @description : 在一次 resize_sem 获取下按顺序执行 cmds[0, count)：BATCH_EXEC 和命令环共用。
+ *                组内有需要独占的命令时整组独占持有，否则共享持有。每条命令的结果写回各自的 result，
+ *                读方向命令的输出写回 arg；设了 CHRDEV_BATCH_STOP_ON_ERR 时在第一条失败处停下。
+ * @return      : 执行了的条数（含停下的那一条）；-EINTR 等锁时收到致命信号
+ */
+static int chrdev_batch_run(struct cdev_private_data_t *data, struct chrdev_batch_cmd *cmds,
+                            unsigned int count, u32 flags)
+{
+    struct chrdev_batch_cmd *c;
+    bool excl = false;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        excl |= chrdev_ctl_excl(cmds[i].cmd);
+
+    if (excl ? down_write_killable(&data->resize_sem) : down_read_killable(&data->resize_sem))
+        return -EINTR;
+    for (i = 0; i < count; i++) {
+        c = &cmds[i];
+        /* 只收 int 参数的命令：GET_META、批量命令和命令环的命令不能嵌套进来 */
+        if ((_IOC_TYPE(c->cmd) != CHRDEV_IOC_MAGIC) || (_IOC_NR(c->cmd) > CHRDEV_IOC_MAXNR) ||
+            (c->cmd == GET_META) || (c->cmd == BATCH_EXEC) || (c->cmd == RING_SETUP) || (c->cmd == RING_ENTER))
+            c->result = -ENOTTY;
+        else
+            c->result = chrdev_ctl_locked(data, c->cmd, &c->arg, false);
+        trace_chrdev_ioctl(c->cmd, c->arg, c->result);
+        if (c->result && (flags & CHRDEV_BATCH_STOP_ON_ERR)) {
+            i++;
+            break;
+        }
+    }
+    if (excl)
+        up_write(&data->resize_sem);
+    else
+        up_read(&data->resize_sem);
+    return i;
+}
+
+/* 
+ * @description : 批量执行：一次系统调用、一次 resize_sem 获取，按顺序执行一组命令。
+ * @return      : 0 成功（单条命令的失败看 result 和 done）；-EINVAL 条数或标志非法；-EFAULT；-ENOMEM；-EINTR
+ */
+static int chrdev_batch_exec(struct cdev_private_data_t *data, struct chrdev_batch __user *ubatch)
+{
+    struct chrdev_batch batch;
+    struct chrdev_batch_cmd *cmds;
+    int ret;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if ((batch.count == 0) || (batch.count > CHRDEV_BATCH_MAX) || (batch.flags & ~CHRDEV_BATCH_STOP_ON_ERR))
+        return -EINVAL;
+
+    cmds = memdup_user(u64_to_user_ptr(batch.cmds), batch.count * sizeof(*cmds));
+    if (IS_ERR(cmds))
+        return PTR_ERR(cmds);
+    ret = chrdev_batch_run(data, cmds, batch.count, batch.flags);
+    if (ret < 0) {
+        kfree(cmds);
+        return ret;
+    }
+
+    batch.done = ret;
+    ret = 0;
+    if (copy_to_user(u64_to_user_ptr(batch.cmds), cmds, batch.done * sizeof(*cmds)) ||
+        put_user(batch.done, &ubatch->done))
+        ret = -EFAULT;
+    kfree(cmds);
+    return ret;
+}
+
+/*************************************命令环：开始***************************************************/
+/* 
+ * 用户空间往共享内存里的提交环写命令、推进 sq_tail，不用为每条命令进一次内核：
+ * 没有轮询线程时攒一批再敲一次门铃（RING_ENTER）；有轮询线程时连门铃都不用敲，线程空闲睡下后才需要。
+ * 消费按批（最多 CHRDEV_BATCH_MAX 条）交给 chrdev_batch_run，一批只拿一次 resize_sem。
+ * 完成环满了就停止消费，剩下的提交项留到用户腾出完成环之后，不丢结果。
+ */
+
+/* 提交环里还有没消费的项。用户写坏了 sq_tail（超出环的容量）时当作空 */
+static u32 cdev_ring_pending(struct cdev_cmd_ring_t *ring)
+{
+    u32 pending = smp_load_acquire(&ring->hdr->sq_tail) - ring->sq_head;
+
+    return (pending > ring->sq_entries) ? 0 : pending;
+}
+
+/* 完成环的空位。用户写坏了 cq_head 时当作已满 */
+static u32 cdev_ring_cq_room(struct cdev_cmd_ring_t *ring)
+{
+    u32 cq_used = ring->cq_tail - smp_load_acquire(&ring->hdr->cq_head);
+
+    return (cq_used > ring->cq_entries) ? 0 : ring->cq_entries - cq_used;
+}
+
+/* 有活可干：提交环里有待消费的，完成环也放得下结果 */
+static bool cdev_ring_runnable(struct cdev_cmd_ring_t *ring)
+{
+    return cdev_ring_pending(ring) && cdev_ring_cq_room(ring);
+}
+
+/* 
+ * @description : 消费提交环直到空了或完成环满了。门铃和轮询线程都走这里，用 ring->lock 串行。
+ * @return      : 消费的条数；一条都没消费就等锁被打断时返回 -EINTR
+ */
+static int cdev_ring_drain(struct cdev_private_data_t *data, struct cdev_cmd_ring_t *ring)
+{
+    struct chrdev_ring_hdr *hdr = ring->hdr;
+    struct chrdev_sqe *sqe;
+    struct chrdev_cqe *cqe;
+    u32 n, i;
+    int total = 0, ret = 0;
+
+    mutex_lock(&ring->lock);
+    for (;;) {
+        n = min3(cdev_ring_pending(ring), cdev_ring_cq_room(ring), (u32)CHRDEV_BATCH_MAX);
+        if (n == 0)
+            break;
+
+        /* 每个字段只读一次：用户可能同时在改提交项 */
+        for (i = 0; i < n; i++) {
+            sqe = &ring->sqes[(ring->sq_head + i) & (ring->sq_entries - 1)];
+            ring->batch[i].cmd = READ_ONCE(sqe->cmd);
+            ring->batch[i].arg = READ_ONCE(sqe->arg);
+            ring->user_data[i] = READ_ONCE(sqe->user_data);
+        }
+        ret = chrdev_batch_run(data, ring->batch, n, 0);
+        if (ret < 0)
+            break;
+
+        ring->sq_head += n;
+        smp_store_release(&hdr->sq_head, ring->sq_head);
+        for (i = 0; i < n; i++) {
+            cqe = &ring->cqes[(ring->cq_tail + i) & (ring->cq_entries - 1)];
+            cqe->user_data = ring->user_data[i];
+            cqe->res = ring->batch[i].result;
+            cqe->arg = ring->batch[i].arg;
+        }
+        ring->cq_tail += n;
+        smp_store_release(&hdr->cq_tail, ring->cq_tail);  /* 完成项先写好，再让用户看到新的 cq_tail */
+        total += n;
+    }
+    mutex_unlock(&ring->lock);
+    return total ? total : ret;
+}
+
+/* 
+ * 轮询线程：有活就一直消费；提交环空了才空转等新提交，空转 sq_idle 之后挂出 NEED_WAKEUP 睡下，等 RING_ENTER 叫醒。
+ * 完成环满了（用户不收割）或批量执行出错时不空转，直接睡下：
+ * 用户收割完成项只改共享内存、不进内核，所以睡眠带超时，定期回来看一眼完成环有没有腾出空位。
+ */
+static int cdev_ring_sqpoll(void *arg)
+{
+    struct cdev_private_data_t *data = arg;
+    struct cdev_cmd_ring_t *ring = data->ring;
+    unsigned long last_busy = jiffies;
+    int ret;
+
+    while (!kthread_should_stop()) {
+        ret = cdev_ring_drain(data, ring);
+        if (ret > 0) {
+            last_busy = jiffies;
+            cond_resched();
+            continue;
+        }
+        if ((ret == 0) && !cdev_ring_pending(ring) && time_before(jiffies, last_busy + ring->sq_idle)) {
+            cond_resched();
+            continue;
+        }
+
+        /* 先挂标志再检查提交环：用户推进 sq_tail 之后读标志，两边总有一方看得到对方 */
+        WRITE_ONCE(ring->hdr->flags, ring->hdr->flags | CHRDEV_RING_NEED_WAKEUP);
+        smp_mb();
+        if (ret < 0)    /* 出错时不看提交环，至少睡一个周期，免得原地重试 */
+            wait_event_interruptible_timeout(ring->sqpoll_wq, kthread_should_stop(), CHRDEV_RING_RECHECK);
+        else
+            wait_event_interruptible_timeout(ring->sqpoll_wq,
+                                             kthread_should_stop() || cdev_ring_runnable(ring),
+                                             CHRDEV_RING_RECHECK);
+        if (!cdev_ring_runnable(ring))  /* 超时醒来仍没活：保持 NEED_WAKEUP，下一轮接着睡 */
+            continue;
+        WRITE_ONCE(ring->hdr->flags, ring->hdr->flags & ~CHRDEV_RING_NEED_WAKEUP);
+        last_busy = jiffies;
+    }
+    return 0;
+}
+
+/* 报告环的参数：新建和已建立时共用 */
+static void cdev_ring_params_fill(struct cdev_cmd_ring_t *ring, struct chrdev_ring_params *p)
+{
+    p->sq_entries = ring->sq_entries;
+    p->cq_entries = ring->cq_entries;
+    p->flags      = ring->flags;
+    p->sq_idle_ms = jiffies_to_msecs(ring->sq_idle);
+    p->sq_off     = (char *)ring->sqes - (char *)ring->mem;
+    p->cq_off     = (char *)ring->cqes - (char *)ring->mem;
+    p->ring_size  = ring->size;
+}
+
+/* 
+ * @description : RING_SETUP：建立命令环，需要时起轮询线程。环已经建立时只报告现有的参数。
+ * @return      : 0 成功；-EINVAL 参数非法；-EFAULT；-ENOMEM；轮询线程起不来时为其错误码（此时不建立环）
+ */
+static int cdev_ring_setup(struct cdev_private_data_t *data, struct file *filp,
+                           struct chrdev_ring_params __user *uparams)
+{
+    struct chrdev_ring_params p;
+    struct cdev_cmd_ring_t *ring;
+    size_t sq_off, cq_off;
+    int err;
+
+    if (copy_from_user(&p, uparams, sizeof(p)))
+        return -EFAULT;
+
+    ring = smp_load_acquire(&data->ring);
+    if (ring)
+        goto report;
+
+    if ((p.sq_entries == 0) || (p.sq_entries > CHRDEV_RING_MAX_ENTRIES) ||
+        (p.cq_entries > 2 * CHRDEV_RING_MAX_ENTRIES) || (p.flags & ~CHRDEV_RING_SQPOLL))
+        return -EINVAL;
+
+    ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+    if (!ring)
+        return -ENOMEM;
+    ring->sq_entries = roundup_pow_of_two(p.sq_entries);
+    ring->cq_entries = roundup_pow_of_two(p.cq_entries ? p.cq_entries : 2 * ring->sq_entries);
+    if (ring->cq_entries < ring->sq_entries)  /* 一批消费的结果要放得下 */
+        ring->cq_entries = ring->sq_entries;
+    ring->flags = p.flags;
+    ring->sq_idle = msecs_to_jiffies(p.sq_idle_ms ? min_t(u32, p.sq_idle_ms, CHRDEV_RING_MAX_IDLE_MS)
+                                                  : CHRDEV_RING_IDLE_MS);
+
+    sq_off = L1_CACHE_ALIGN(sizeof(struct chrdev_ring_hdr));
+    cq_off = L1_CACHE_ALIGN(sq_off + ring->sq_entries * sizeof(struct chrdev_sqe));
+    ring->size = PAGE_ALIGN(cq_off + ring->cq_entries * sizeof(struct chrdev_cqe));
+    ring->mem = vzalloc(ring->size);
+    if (!ring->mem) {
+        err = -ENOMEM;
+        goto fail_mem;
+    }
+    ring->hdr  = ring->mem;
+    ring->sqes = ring->mem + sq_off;
+    ring->cqes = ring->mem + cq_off;
+    ring->hdr->sq_mask = ring->sq_entries - 1;
+    ring->hdr->cq_mask = ring->cq_entries - 1;
+    mutex_init(&ring->lock);
+    init_waitqueue_head(&ring->sqpoll_wq);
+
+    /* 轮询线程在发布之前建好（先不运行）：起不来就整个撤销，不会发布一个标志与线程对不上的环 */
+    if (p.flags & CHRDEV_RING_SQPOLL) {
+        ring->sqpoll = kthread_create(cdev_ring_sqpoll, data, "chrdev-sqpoll");
+        if (IS_ERR(ring->sqpoll)) {
+            err = PTR_ERR(ring->sqpoll);
+            goto fail_thread;
+        }
+        ring->sqpoll_owner = filp;
+    }
+
+    /* 并发的 RING_SETUP 只有一个装得进去，其余的报告装进去的那个 */
+    if (cmpxchg(&data->ring, NULL, ring)) {
+        if (ring->sqpoll)
+            kthread_stop(ring->sqpoll);  /* 还没运行过，线程函数不会被调用 */
+        vfree(ring->mem);
+        kfree(ring);
+        ring = data->ring;
+        goto report;
+    }
+    if (ring->sqpoll)
+        wake_up_process(ring->sqpoll);  /* 环已发布，线程从 data->ring 取到它 */
+
+report:
+    cdev_ring_params_fill(ring, &p);
+    return copy_to_user(uparams, &p, sizeof(p)) ? -EFAULT : 0;
+
+fail_thread:
+    vfree(ring->mem);
+fail_mem:
+    kfree(ring);
+    return err;
+}
+
+/* RING_ENTER：有轮询线程时叫醒它（返回 0），否则当场消费，返回消费的条数 */
+static int cdev_ring_enter(struct cdev_private_data_t *data)
+{
+    struct cdev_cmd_ring_t *ring = smp_load_acquire(&data->ring);
+
+    if (!ring)
+        return -ENXIO;
+    if (READ_ONCE(ring->sqpoll)) {
+        wake_up_interruptible(&ring->sqpoll_wq);
+        return 0;
+    }
+    return cdev_ring_drain(data, ring);
+}
+
+/* 
+ * @description : 关闭 file 时调用：它起的轮询线程跟着停下，环留给其他打开者用门铃。
+ *                挂出 NEED_WAKEUP 让仍在提交的一方改敲门铃，停线程前后漏掉的提交在这里当场消费。
+ */
+static void cdev_ring_release(struct cdev_private_data_t *data, struct file *filp)
+{
+    struct cdev_cmd_ring_t *ring = smp_load_acquire(&data->ring);
+    struct task_struct *sqpoll;
+
+    if (!ring || (ring->sqpoll_owner != filp))
+        return;
+    sqpoll = xchg(&ring->sqpoll, NULL);
+    if (!sqpoll)
+        return;
+    ring->flags &= ~CHRDEV_RING_SQPOLL;
+    WRITE_ONCE(ring->hdr->flags, ring->hdr->flags | CHRDEV_RING_NEED_WAKEUP);
+    kthread_stop(sqpoll);
+    ring->sqpoll_owner = NULL;
+    cdev_ring_drain(data, ring);
+}
+
+/* 释放命令环：缓冲区释放时调用，此时已没有打开者，也就没有映射 */
+static void cdev_ring_free(struct cdev_private_data_t *data)
+{
+    struct cdev_cmd_ring_t *ring = data->ring;
+
+    if (!ring)
+        return;
+    if (ring->sqpoll)
+        kthread_stop(ring->sqpoll);
+    vfree(ring->mem);
+    kfree(ring);
+    data->ring = NULL;
+}
+
+static vm_fault_t ring_vm_fault(struct vm_fault *vmf)
+{
+    struct cdev_cmd_ring_t *ring = vmf->vma->vm_private_data;
+    unsigned long offset = (vmf->pgoff << PAGE_SHIFT) - CHRDEV_RING_MMAP_OFF;
+    struct page *page;
+
+    if (offset >= ring->size)
+        return VM_FAULT_SIGBUS;
+
+    page = vmalloc_to_page(ring->mem + offset);
+    get_page(page);
+    vmf->page = page;
+    return 0;
+}
+
+static const struct vm_operations_struct ring_vm_ops = {
+    .fault = ring_vm_fault,
+};
+
+/* 映射命令环：偏移必须正好是 CHRDEV_RING_MMAP_OFF，长度不超过环的大小 */
+static int cdev_ring_mmap(struct cdev_private_data_t *data, struct vm_area_struct *vma)
+{
+    struct cdev_cmd_ring_t *ring = smp_load_acquire(&data->ring);
+
+    if (!ring)
+        return -ENXIO;
+    if (vma->vm_pgoff != (CHRDEV_RING_MMAP_OFF >> PAGE_SHIFT) || (vma_pages(vma) > (ring->size >> PAGE_SHIFT)))
+        return -EINVAL;
+    chrdev_vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    vma->vm_ops = &ring_vm_ops;
+    vma->vm_private_data = ring;
+    return 0;
+}
+/*************************************命令环：结束***************************************************/
+
+/* ioctl 入口：按命令的方向位与用户空间交换 int 参数，执行交给 chrdev_ctl_exec */
+static long do_dev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct cdev_private_data_t *data = filp->private_data;
+    int ret = 0;
+    int val = 0;
+
+    /* 验证命令有效性 */
+    if (_IOC_TYPE(cmd) != CHRDEV_IOC_MAGIC) return -ENOTTY;
+    if (_IOC_NR(cmd) > CHRDEV_IOC_MAXNR) return -ENOTTY;
+
+    /* 参数不是 int 的命令单独处理 */
+    if (cmd == GET_META) {
+        struct chrdev_meta meta;
+
+        cdev_meta_snapshot(data, &meta);
+        return copy_to_user((void __user *)arg, &meta, sizeof(meta)) ? -EFAULT : 0;
+    }
+    if (cmd == BATCH_EXEC)
+        return chrdev_batch_exec(data, (struct chrdev_batch __user *)arg);
+    if (cmd == RING_SETUP)
+        return cdev_ring_setup(data, filp, (struct chrdev_ring_params __user *)arg);
+    if (cmd == RING_ENTER)
+        return cdev_ring_enter(data);
+
+    if ((_IOC_DIR(cmd) & _IOC_WRITE) && copy_from_user(&val, (int __user *)arg, sizeof(val)))
+        return -EFAULT;
+
+    ret = chrdev_ctl_exec(data, cmd, &val, false);
+    trace_chrdev_ioctl(cmd, val, ret);
+    if (ret)
+        return ret;
+
+    if ((_IOC_DIR(cmd) & _IOC_READ) && copy_to_user((int __user *)arg, &val, sizeof(val)))
+        return -EFAULT;
+    return 0;
+}
+
+/* 计入 ioctl 次数和延迟（含参数拷贝） */
+static long dev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct cdev_private_data_t *data = filp->private_data;
+    u64 t0 = cdev_stat_begin();
+    long ret = do_dev_ioctl(filp, cmd, arg);
+
+    cdev_stat_op(data->stats, CDEV_OP_IOCTL, ret, t0);
+    return ret;
+}
+
+#ifdef CHRDEV_HAVE_URING_CMD
+/* 
+ * @description : io_uring 透传（IORING_OP_URING_CMD）：与 ioctl 同一套命令。
+ *                SQE 的 cmd_op 填 ioctl 命令号，写方向的参数放在 SQE 的 cmd 区（struct chrdev_uring_cmd），
+ *                读方向的结果直接作为 CQE 的 res 返回。应用可以把几十个控制操作塞进一次提交，
+ *                再异步收割完成事件，不必每个操作一次 ioctl 系统调用。
+ * @return      : 读方向命令返回读到的值；其余返回 0；负数错误码
+ */
+static int dev_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+    struct cdev_private_data_t *data = ioucmd->file->private_data;
+    const struct chrdev_uring_cmd *ucmd = chrdev_uring_cmd_payload(ioucmd);
+    unsigned int cmd = ioucmd->cmd_op;
+    u64 t0 = cdev_stat_begin();
+    int val = 0;
+    int ret;
+
+    if (_IOC_TYPE(cmd) != CHRDEV_IOC_MAGIC) return -ENOTTY;
+    if (_IOC_NR(cmd) > CHRDEV_IOC_MAXNR) return -ENOTTY;
 
-    /* 1、寄存器地址映射 */ 
-    // 这部分代码，转移到了平台设备驱动模型中，前面已经解析出硬件信息，并做了这部分的映射。
-    
-    /* 2、使能 PI 时钟 */ 
-    val = readl(MPU_AHB4_PERIPH_RCC_PI); 
-    val &= ~(0X1 << 8);                 /* 清除以前的设置   */ 
-    val |= (0X1 << 8);                  /* 设置新值      */ 
-    writel(val, MPU_AHB4_PERIPH_RCC_PI); 
-    
-    /* 3、设置 PI0 通用的输出模式。*/ 
-    val = readl(GPIOI_MODER_PI); 
-    val &= ~(0X3 << 0);                 /* bit0:1 清零    */ 
-    val |= (0X1 << 0);                  /* bit0:1 设置 01   */ 
-    writel(val, GPIOI_MODER_PI); 
-    
-    /* 3、设置 PI0 为推挽模式。*/ 
-    val = readl(GPIOI_OTYPER_PI); 
-    val &= ~(0X1 << 0);                 /* bit0 清零，设置为上拉*/ 
-    writel(val, GPIOI_OTYPER_PI); 
-    /* 4、设置 PI0 为高速。*/ 
-    val = readl(GPIOI_OSPEEDR_PI); 
-    val &= ~(0X3 << 0);                 /* bit0:1 清零     */ 
-    val |= (0x2 << 0);                  /* bit0:1 设置为 10   */ 
-    writel(val, GPIOI_OSPEEDR_PI); 
-    
-    /* 5、设置 PI0 为上拉。*/ 
-    val = readl(GPIOI_PUPDR_PI); 
-    val &= ~(0X3 << 0);                 /* bit0:1 清零     */ 
-    val |= (0x1 << 0);                  /*bit0:1 设置为 01    */ 
-    writel(val,GPIOI_PUPDR_PI); 
-    
-    /* 6、默认关闭 LED */ 
-    val = readl(GPIOI_BSRR_PI); 
-    val |= (0x1 << 0); 
-    writel(val, GPIOI_BSRR_PI); 
+    if (_IOC_DIR(cmd) & _IOC_WRITE)
+        val = READ_ONCE(ucmd->arg);
+
+    /* 内联提交不能睡眠：返回 -EAGAIN 后 io_uring 会转到 io-wq 线程里重试 */
+    ret = chrdev_ctl_exec(data, cmd, &val, issue_flags & IO_URING_F_NONBLOCK);
+    trace_chrdev_ioctl(cmd, val, ret);
+    cdev_stat_op(data->stats, CDEV_OP_IOCTL, ret, t0);
+    if (ret)
+        return ret;
+    return (_IOC_DIR(cmd) & _IOC_READ) ? val : 0;
 }
+#endif
 
 /* 
- * @description : LED 打开/关闭
- * @param - sta : 关闭LED:LEDON(0)；打开LED:LEDOFF(1)
- * @return      : 无
- */ 
-void led_switch(u8 sta)
-{ 
-    u32 val = 0;
-    if(sta == LEDON)
-    {
-        val = readl(GPIOI_BSRR_PI);
-        val |= (1 << 16);
-        writel(val, GPIOI_BSRR_PI);
-    }else if(sta == LEDOFF)
-    {
-        val = readl(GPIOI_BSRR_PI);
-        val|= (1 << 0);
-        writel(val, GPIOI_BSRR_PI);
-    }
+ * @description : mmap 缺页处理：用户首次访问某页时才建立映射（惰性填充）
+ *                缓冲区由 vmalloc 分配，按页查出物理页交给内核页表。
+ * @param - vmf : 缺页描述，vmf->pgoff 为相对缓冲区起点的页号
+ * @return      : 0 成功；VM_FAULT_SIGBUS 访问越过缓冲区
+ */
+static vm_fault_t dev_vm_fault(struct vm_fault *vmf)
+{
+    struct cdev_private_data_t *data = vmf->vma->vm_private_data;
+    unsigned long offset = vmf->pgoff << PAGE_SHIFT;
+    struct page *page;
+
+    if (offset >= PAGE_ALIGN(data->buf_size))
+        return VM_FAULT_SIGBUS;
+
+    page = vmalloc_to_page(data->buffer + offset);
+    get_page(page);     /* 引用计数交给页表，解除映射时由内核释放 */
+    vmf->page = page;
+    return 0;
 }
 
-/* 
- * @description :重置硬件资源
- * @return      : 无
- */ 
-void led_deinit(void)
+/* 映射的建立（含 fork 复制）与拆除：计数不为 0 时 RESIZE_BUF 返回 -EBUSY */
+static void dev_vm_open(struct vm_area_struct *vma)
 {
-    /* 解除映射 */ 
-    iounmap(MPU_AHB4_PERIPH_RCC_PI); 
-    iounmap(GPIOI_MODER_PI); 
-    iounmap(GPIOI_OTYPER_PI); 
-    iounmap(GPIOI_OSPEEDR_PI); 
-    iounmap(GPIOI_PUPDR_PI); 
-    iounmap(GPIOI_BSRR_PI); 
-    
-    /* 应该还有其他硬件资源需要重置
-     * 但是这里只是演示，无需太严格
-     * 所以，只写这些，其他省略。
-    */
-    
+    struct cdev_private_data_t *data = vma->vm_private_data;
+
+    atomic_inc(&data->mmap_count);
 }
 
-/*************************************实际受控的硬件（GPIO）驱动代码：结束***************************************************/
+static void dev_vm_close(struct vm_area_struct *vma)
+{
+    struct cdev_private_data_t *data = vma->vm_private_data;
 
-static int dev_open(struct inode *inode, struct file *filp) {
-    filp->private_data = &chrdev.dev_data;
-    printk(KERN_INFO "内核 chrdev_open：设备已被 pid %d 打开！\n", current->pid);
-    return 0;
+    atomic_dec(&data->mmap_count);
 }
 
-/* llseek 函数跟字符设备驱动的数据，可以无任何直接关联，只通过 offset 间接关联。 */
-/* loff_t 类型是 signed long long 有符号数值 */
-loff_t dev_llseek (struct file *filp, loff_t offset, int whence){
+static const struct vm_operations_struct dev_vm_ops = {
+    .open  = dev_vm_open,
+    .close = dev_vm_close,
+    .fault = dev_vm_fault,
+};
 
+/* 
+ * @description : 把内核缓冲区映射到用户空间，读写方直接原地访问数据，免去 copy_to_user/copy_from_user。
+ *                有效数据长度仍通过 ioctl(MAPLEAY_UPDATE_DAT_LEN / GET_DATA_LEN) 登记和查询。
+ * @return      : 0 成功；-EINVAL 映射范围越过缓冲区；-EINTR 等锁时收到致命信号
+ */
+static int dev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
     struct cdev_private_data_t *data = filp->private_data;
-    loff_t new_pos = 0;
-    /* 对进程的 f_ops 进行校验，防止意外 */
-    if ((filp->f_pos < 0) || (filp->f_pos > data->buf_size)) {
+    unsigned long pages = vma_pages(vma);
+    unsigned long buf_pages, mask;
+    int err;
+
+    /* 命令环的映射与缓冲区模式无关 */
+    if (vma->vm_pgoff >= (CHRDEV_RING_MMAP_OFF >> PAGE_SHIFT))
+        return cdev_ring_mmap(data, vma);
+
+    /* FIFO 模式的读写位置不对用户空间公开，映射出去没有意义；稀疏模式没有连续的缓冲区可映射 */
+    if (buf_mode != BUF_MODE_FLAT)
+        return -EINVAL;
+
+    /* 与调整大小互斥：检查范围和登记映射之间缓冲区不能被换掉 */
+    if (down_read_killable(&data->resize_sem))
+        return -EINTR;
+    buf_pages = PAGE_ALIGN(data->buf_size) >> PAGE_SHIFT;
+    if ((vma->vm_pgoff >= buf_pages) || (pages > buf_pages - vma->vm_pgoff)) {
+        up_read(&data->resize_sem);
+        printk(KERN_ERR "内核 dev_mmap：映射范围越过缓冲区！\n");
         return -EINVAL;
     }
 
-    switch (whence) {
-        case SEEK_SET:
-                if ((offset < 0) || (offset > data->buf_size)) {
-                    printk(KERN_INFO "内核 dev_llseek:SEEK_SET:文件偏移失败！！\n");
-                    return -EINVAL;
-                }
-                filp->f_pos = offset;
-                break;
+    /* 先计数再补齐过期块：之后的清空看到计数就会当场清零，映射出去的页里不会留下作废的旧内容 */
+    vma->vm_private_data = data;
+    dev_vm_open(vma);  /* mmap 本身不会调用 vm_ops->open，首个映射在这里计数 */
+    err = range_lock(data, 0, data->buf_size, true, false, &mask);
+    if (err) {
+        dev_vm_close(vma);
+        up_read(&data->resize_sem);
+        return err;
+    }
+    flat_chunks_revive(data, 0, PAGE_ALIGN(data->buf_size));
+    range_unlock(data, mask, true);
 
-        case SEEK_CUR:
-                new_pos = filp->f_pos + offset;
-                if ((new_pos < 0) || (new_pos > data->buf_size)){
-                    printk(KERN_INFO "内核 dev_llseek:SEEK_CUR:文件偏移失败！！\n");
-                    return -EINVAL;
-                }
-                filp->f_pos = new_pos;
-                break;
+    /* 不预先建立页表，等缺页时再逐页填充；禁止 mremap 扩大、不写入 core dump */
+    chrdev_vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    vma->vm_ops = &dev_vm_ops;
+    up_read(&data->resize_sem);
+    return 0;
+}
 
-        case SEEK_END:
-                new_pos = data->buf_size + offset;
-                if ((new_pos < 0) || (new_pos > data->buf_size)){
-                    printk(KERN_INFO "内核 dev_llseek:SEEK_END:文件偏移失败！！\n");
-                    return -EINVAL;
-                }
-                filp->f_pos = new_pos;
-                break;
+static int dev_release(struct inode *inode, struct file *file) {
+    struct cdev_private_data_t *data = file->private_data;
 
-        default: return -EINVAL; /* 禁止隐式偏移 */
-    }
-    return filp->f_pos;
+    /* 这个 file 起的命令环轮询线程不能比它活得久 */
+    cdev_ring_release(data, file);
+
+    /* 挂起的异步读各自持有 file 引用，通常等不到这里；兜底取消这个 file 名下还挂着的 */
+    if (buf_mode == BUF_MODE_FIFO)
+        fifo_aio_flush(data, file);
+
+    /* 独立会话随最后一次关闭一起释放（mmap 的映射也持有 file 引用，不会提前释放） */
+    if (data->per_open)
+        session_free(data);
+    trace_chrdev_release(iminor(inode));
+    return 0;
 }
 
-/* 提示：read/write处理风格都是：二进制安全型！所以使用char类型代表单个字节，所有以单个字节的操作都是安全且兼容性强的 */
-static ssize_t dev_read(struct file *filp, char __user *buf, size_t len_to_meet, loff_t *off) {
+static struct file_operations fops = {
+    .owner          = THIS_MODULE,
+    .llseek         = dev_llseek,
+    .open           = dev_open,
+    .read_iter      = dev_read_iter,
+    .write_iter     = dev_write_iter,
+    /* splice：数据在内核缓冲区与管道页之间直接搬运，不再经用户空间中转。
+     * 两者都建立在 read_iter/write_iter 之上（管道/bvec 类型的 iov_iter）。 */
+    .splice_read    = chrdev_splice_read,
+    .splice_write   = iter_file_splice_write,
+    .unlocked_ioctl = dev_ioctl,
+#ifdef CHRDEV_HAVE_URING_CMD
+    .uring_cmd      = dev_uring_cmd,
+#endif
+    .poll           = dev_poll,
+    .mmap           = dev_mmap,
+    .release        = dev_release,
+};
 
-    struct cdev_private_data_t *data = filp->private_data;
-    size_t cnt_read = min_t(size_t, len_to_meet, data->data_len - *off); //min截短
+/* sysfs 属性 stats：cat /sys/class/mapleay-chrdev-class/<设备名>/stats 查看本次设备的统计（须打开 instrument 才计数） */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    chrdev_minor_t *minor = dev_get_drvdata(dev);
+    struct cdev_pcpu_stats_t sum;
+    ssize_t len;
 
-    if (cnt_read == 0) {
-        printk(KERN_INFO "内核 chrdev_read：内核数据早已读出完毕！无法继续读出！\n");
-        return 0;
-    }
+    cdev_stats_sum(&minor->stats, &sum);
+    len = scnprintf(buf, PAGE_SIZE,
+                    "opens %lu\nreads %lu\nwrites %lu\nbytes_read %llu\nbytes_written %llu\n",
+                    sum.opens, sum.reads, sum.writes, sum.bytes_read, sum.bytes_written);
+    if (buf_mode == BUF_MODE_PERCPU)  /* 次设备共享缓冲区中因环满被覆盖的记录数 */
+        len += scnprintf(buf + len, PAGE_SIZE - len, "dropped %lu\n", pcpu_dropped(&minor->dev_data));
+    return len;
+}
+static DEVICE_ATTR_RO(stats);
 
-    if (copy_to_user(buf, data->buffer + *off, cnt_read)) {
-        printk(KERN_ERR "内核 chrdev_read：从内核复制数据到用户空间操作失败！\n");
-        return -EFAULT;
-    }
+/* sysfs 属性 led：cat /sys/class/mapleay-chrdev-class/<设备名>/led 读 LED 状态（1 亮 0 灭），只读影子 */
+static ssize_t led_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return scnprintf(buf, PAGE_SIZE, "%u\n", led_get());
+}
+static DEVICE_ATTR_RO(led);
 
-    *off += cnt_read;
-    printk(KERN_INFO "内核 chrdev_read：已从内核读出 %zu 字节的数据，当下偏移位于 %lld处。\n", cnt_read, *off);
-    return cnt_read;
+/* debugfs 的 stats：全部计数器 */
+static int debug_stats_show(struct seq_file *m, void *v)
+{
+    chrdev_minor_t *minor = m->private;
+    struct cdev_pcpu_stats_t sum;
+
+    cdev_stats_sum(&minor->stats, &sum);
+    seq_printf(m, "instrument    %s\n", static_key_enabled(&instrument_key) ? "on" : "off");
+    seq_printf(m, "opens         %lu\n", sum.opens);
+    seq_printf(m, "reads         %lu\n", sum.reads);
+    seq_printf(m, "writes        %lu\n", sum.writes);
+    seq_printf(m, "ioctls        %lu\n", sum.ioctls);
+    seq_printf(m, "bytes_read    %llu\n", sum.bytes_read);
+    seq_printf(m, "bytes_written %llu\n", sum.bytes_written);
+    seq_printf(m, "enospc        %lu\n", sum.enospc);
+    seq_printf(m, "efault        %lu\n", sum.efault);
+    seq_printf(m, "led_switches  %lu\n", sum.led_switches);
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(debug_stats);
 
-/* 提示：read/write处理风格都是：二进制安全型！所以使用char类型代表单个字节，所有以单个字节的操作都是安全且兼容性强的 */
-static ssize_t dev_write(struct file *filp, const char __user *buf, size_t len_to_meet, loff_t *off) {
-    struct cdev_private_data_t *data = filp->private_data;
-    size_t cnt_write = min_t(size_t, len_to_meet, data->buf_size - *off); //min，二进制安全，取小。OK。
-    
-    if (cnt_write == 0) {
-        printk(KERN_INFO "内核 chrdev_write：内核缓冲区已满，无法继续写入！\n");
-        return -ENOSPC;
-    }
-    
-    if (copy_from_user(data->buffer + *off, buf, cnt_write)) {
-        printk(KERN_ERR "内核 chrdev_write：从用户空间复制数据到内核空间的操作失败！\n");
-        return -EFAULT;
+/* debugfs 的 latency：读/写/ioctl 的 log2 延迟直方图，只列出非空的桶 */
+static int debug_latency_show(struct seq_file *m, void *v)
+{
+    static const char * const op_names[CDEV_OP_NR] = { "read", "write", "ioctl" };
+    chrdev_minor_t *minor = m->private;
+    struct cdev_pcpu_stats_t sum;
+    unsigned int op, i;
+
+    cdev_stats_sum(&minor->stats, &sum);
+    for (op = 0; op < CDEV_OP_NR; op++) {
+        seq_printf(m, "%s (ns):\n", op_names[op]);
+        for (i = 0; i < LAT_BUCKETS; i++) {
+            if (!sum.lat[op][i])
+                continue;
+            if (i == LAT_BUCKETS - 1)
+                seq_printf(m, "  [%10llu, ...) %lu\n", 1ULL << (i - 1), sum.lat[op][i]);
+            else
+                seq_printf(m, "  [%10llu, %10llu) %lu\n", i ? 1ULL << (i - 1) : 0, 1ULL << i, sum.lat[op][i]);
+        }
     }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(debug_latency);
+
+/*************************************debugfs 缓冲区转储：开始***************************************************/
+/* 
+ * hexdump（十六进制 + ASCII）和 raw（原始字节）两个 seq_file 视图，只读不消费。
+ * 窗口由同目录下的 dump_offset/dump_length 指定，打开文件时按当时的数据长度截定。
+ * 每条 seq 记录单独拷一小块、单独拿放锁：大窗口也是边拷边吐，不会长时间挡住写者。
+ */
+#define DUMP_HEX_REC    1024   /* hexdump 每条记录的字节数：64 行 */
+#define DUMP_HEX_ROW    16
+
+/* 当前内容的长度，与 GET_DATA_LEN 口径一致 */
+static size_t cdev_dump_len(struct cdev_private_data_t *data)
+{
+    struct chrdev_meta meta;
+
+    if (buf_mode == BUF_MODE_PERCPU)
+        return pcpu_data_len(data);
+    cdev_meta_snapshot(data, &meta);
+    return meta.data_len;
+}
+
+/* 
+ * @description : 不消费地拷出内容中 [pos, pos + len) 的字节。FIFO 的内容从 tail 算起；
+ *                每 CPU 模式按 CPU 顺序把各环现存的记录首尾相接（不做时间归并）。
+ * @return      : 实际拷出的字节数，内容在两次调用之间变短时会不足 len；-EINTR 等锁时收到致命信号
+ */
+static ssize_t cdev_dump_peek(struct cdev_private_data_t *data, loff_t pos, char *dst, size_t len)
+{
+    struct cdev_pcpu_ring_t *ring;
+    struct cdev_pcpu_rec_t *rec;
+    struct cdev_snap_t *snap;
+    struct page *page;
+    unsigned long mask;
+    unsigned int cpu, seq;
+    size_t done, chunk, start;
+    loff_t skip;
+    ssize_t ret;
 
-    /* 硬件LED灯控制部分: 提示，注意 data->buffer[0] 表示缓冲区第0位。而不是 (*off) */
-    if(data->buffer[0] == LEDON) {
-        led_switch(LEDON);  /* 打开 LED 灯  */
+    if (buf_mode == BUF_MODE_SNAPSHOT) {  /* 拷当前版本，不拿锁 */
+        snap = snap_get(data);
+        len = (pos < snap->len) ? min_t(size_t, len, snap->len - pos) : 0;
+        memcpy(dst, snap->data + pos, len);
+        snap_put(snap);
+        return len;
     }
-    else if(data->buffer[0] == LEDOFF) { 
-        led_switch(LEDOFF);  /* 关闭 LED 灯  */
+
+    if (buf_mode == BUF_MODE_PERCPU) {  /* 只在各环的自旋锁下拷贝，不挡合并读者 */
+        skip = pos;
+        done = 0;
+        for_each_possible_cpu(cpu) {
+            ring = per_cpu_ptr(data->pcpu, cpu);
+            spin_lock(&ring->lock);
+            for (seq = ring->tail; (seq != ring->head) && (done < len); seq++) {
+                rec = &ring->recs[seq % PCPU_RING_SLOTS];
+                if (skip >= rec->len) {
+                    skip -= rec->len;
+                    continue;
+                }
+                chunk = min_t(size_t, rec->len - skip, len - done);
+                memcpy(dst + done, rec->data + skip, chunk);
+                done += chunk;
+                skip = 0;
+            }
+            spin_unlock(&ring->lock);
+        }
+        return done;
     }
-    else{
-        printk(KERN_INFO "内核缓冲区内容：data->buffer[0]的值是：%d\n", data->buffer[0]);
-        printk(KERN_ERR "硬件操控失败！\n");
+
+    /* 平铺/稀疏/FIFO 都要访问 buffer 或页面：共享持有 resize_sem，期间不会被换掉 */
+    if (down_read_killable(&data->resize_sem))
+        return -EINTR;
+
+    if (buf_mode == BUF_MODE_FIFO) {
+        if (mutex_lock_killable(&data->lock)) {
+            ret = -EINTR;
+            goto out;
+        }
+        len   = (pos < data->data_len) ? min_t(size_t, len, data->data_len - pos) : 0;
+        start = (data->tail + pos) % data->buf_size;
+        chunk = min_t(size_t, len, data->buf_size - start);
+        memcpy(dst, data->buffer + start, chunk);
+        memcpy(dst + chunk, data->buffer, len - chunk);
+        mutex_unlock(&data->lock);
+        ret = len;
+        goto out;
     }
 
-    *off += cnt_write;
-    data->data_len = max_t(size_t, data->data_len, *off); //max，二进制安全，取大。OK。
-    printk(KERN_INFO "内核 chrdev_write：已写入内核： %zu 字节的数据，当下偏移位位于 %lld 处。\n", cnt_write, *off);
-    return cnt_write;
+    len = (pos < data->data_len) ? min_t(size_t, len, data->data_len - pos) : 0;
+    ret = range_lock(data, pos, len, false, false, &mask);
+    if (ret)
+        goto out;
+    if (buf_mode == BUF_MODE_SPARSE) {
+        for (done = 0; done < len; done += chunk) {  /* 有页就拷贝，空洞就填零 */
+            page  = xa_load(&data->pages, (pos + done) >> PAGE_SHIFT);
+            start = offset_in_page(pos + done);
+            chunk = min_t(size_t, len - done, PAGE_SIZE - start);
+            if (page)
+                memcpy(dst + done, page_address(page) + start, chunk);
+            else
+                memset(dst + done, 0, chunk);
+        }
+    } else {
+        struct kvec kv = { .iov_base = dst, .iov_len = len };
+        struct iov_iter iter;
+
+        iov_iter_kvec(&iter, READ, &kv, 1, len);
+        flat_copy_out(data, pos, len, &iter);
+    }
+    range_unlock(data, mask, false);
+    ret = len;
+out:
+    up_read(&data->resize_sem);
+    return ret;
 }
 
-static long dev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
-    struct cdev_private_data_t *data = filp->private_data;
-    int ret = 0;
-    int val = 0;
-    int i   = 0;
+/* 一次打开的转储游标：窗口 [start, end) 在打开时截定 */
+struct cdev_dump_iter {
+    chrdev_minor_t *minor;
+    loff_t start;
+    loff_t end;
+    loff_t cur;            /* 当前记录的起点 */
+    size_t rec;            /* 每条记录的字节数 */
+    char   buf[PAGE_SIZE];
+};
 
-    /* 验证命令有效性 */
-    if (_IOC_TYPE(cmd) != CHRDEV_IOC_MAGIC) return -ENOTTY;
-    if (_IOC_NR(cmd) > CHRDEV_IOC_MAXNR) return -ENOTTY;
+static void *dump_seq_start(struct seq_file *m, loff_t *pos)
+{
+    struct cdev_dump_iter *it = m->private;
 
-    switch (cmd) {
-        case CLEAR_BUF:  /* 清除缓冲区 */
-            data->data_len = 0;
-            memset(data->buffer, 0, data->buf_size);
-            printk(KERN_INFO "ioctl: 缓冲区已清空\n");
-            break;
+    it->cur = it->start + *pos * it->rec;
+    return (it->cur < it->end) ? it : NULL;
+}
 
-        case GET_BUF_SIZE:  /* 获取缓冲区大小 */
-            val = data->buf_size;
-            if (copy_to_user((int __user *)arg, &val, sizeof(val)))
-                return -EFAULT;
-            break;
+static void *dump_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    ++*pos;
+    return dump_seq_start(m, pos);
+}
 
-        case GET_DATA_LEN:  /* 获取当前数据长度 */
-            val = data->data_len;
-            if (copy_to_user((int __user *)arg, &val, sizeof(val)))
-                return -EFAULT;
-            break;
+static void dump_seq_stop(struct seq_file *m, void *v)
+{
+}
 
-        case MAPLEAY_UPDATE_DAT_LEN:  /* 自定义：更新有效数据长度 */
-            if (copy_from_user(&val, (int __user *)arg, sizeof(arg)))
-                return -EFAULT;
-            data->data_len = val;  //设置有效数据长度
-            val = 12345678;        //特殊数字 仅用来测试 _IORW 的返回方向。
-            if (copy_to_user((int __user *)arg, &val, sizeof(val)))
-                return -EFAULT;
-            break;
-        case PRINT_BUF_DATA:
-            printk(KERN_INFO"内核操作：打印当前缓冲区的值：开始：\n");
-            for (i = 0; i < data->data_len; i++){
-                printk(KERN_INFO "%d ", data->buffer[i]);
-            }
-            printk(KERN_INFO"内核操作：打印当前缓冲区的值：结束。\n");
-            break;
+static int dump_hex_show(struct seq_file *m, void *v)
+{
+    struct cdev_dump_iter *it = v;
+    char prefix[24];
+    ssize_t got;
+    size_t i;
 
-        default:
-            return -ENOTTY;
+    got = cdev_dump_peek(&it->minor->dev_data, it->cur, it->buf, min_t(loff_t, it->rec, it->end - it->cur));
+    if (got < 0)
+        return got;
+    for (i = 0; i < got; i += DUMP_HEX_ROW) {
+        snprintf(prefix, sizeof(prefix), "%08llx: ", it->cur + i);
+        seq_hex_dump(m, prefix, DUMP_PREFIX_NONE, DUMP_HEX_ROW, 1,
+                     it->buf + i, min_t(size_t, got - i, DUMP_HEX_ROW), true);
     }
-    return ret;
+    return 0;
 }
 
-static int dev_release(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "内核 chrdev_release：设备已被 pid 为 %d 的进程释放！\n", current->pid);
+static int dump_raw_show(struct seq_file *m, void *v)
+{
+    struct cdev_dump_iter *it = v;
+    ssize_t got;
+
+    got = cdev_dump_peek(&it->minor->dev_data, it->cur, it->buf, min_t(loff_t, it->rec, it->end - it->cur));
+    if (got < 0)
+        return got;
+    seq_write(m, it->buf, got);
     return 0;
 }
 
-static struct file_operations fops = {
-    .owner          = THIS_MODULE,
-    .llseek         = dev_llseek,
-    .open           = dev_open,
-    .read           = dev_read,
-    .write          = dev_write,
-    .unlocked_ioctl = dev_ioctl,
-    .release        = dev_release,
+static const struct seq_operations dump_hex_seq_ops = {
+    .start = dump_seq_start,
+    .next  = dump_seq_next,
+    .stop  = dump_seq_stop,
+    .show  = dump_hex_show,
+};
+
+static const struct seq_operations dump_raw_seq_ops = {
+    .start = dump_seq_start,
+    .next  = dump_seq_next,
+    .stop  = dump_seq_stop,
+    .show  = dump_raw_show,
+};
+
+static int dump_open(struct inode *inode, struct file *file, const struct seq_operations *ops, size_t rec)
+{
+    chrdev_minor_t *minor = inode->i_private;
+    struct cdev_dump_iter *it;
+    size_t len = cdev_dump_len(&minor->dev_data);
+
+    it = __seq_open_private(file, ops, sizeof(*it));
+    if (!it)
+        return -ENOMEM;
+    it->minor = minor;
+    it->rec   = rec;
+    it->start = min_t(u64, READ_ONCE(minor->dump_off), len);
+    it->end   = READ_ONCE(minor->dump_len) ? min_t(u64, it->start + READ_ONCE(minor->dump_len), len) : len;
+    return 0;
+}
+
+static int dump_hex_open(struct inode *inode, struct file *file)
+{
+    return dump_open(inode, file, &dump_hex_seq_ops, DUMP_HEX_REC);
+}
+
+static int dump_raw_open(struct inode *inode, struct file *file)
+{
+    return dump_open(inode, file, &dump_raw_seq_ops, PAGE_SIZE);
+}
+
+static const struct file_operations dump_hex_fops = {
+    .owner   = THIS_MODULE,
+    .open    = dump_hex_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = seq_release_private,
+};
+
+static const struct file_operations dump_raw_fops = {
+    .owner   = THIS_MODULE,
+    .open    = dump_raw_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = seq_release_private,
 };
+/*************************************debugfs 缓冲区转储：结束***************************************************/
+
+static struct attribute *chrdev_minor_attrs[] = {
+    &dev_attr_stats.attr,
+    &dev_attr_led.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(chrdev_minor);
+
+/* 
+ * @description : 确定次设备数量：模块参数优先，其次设备树 minor-count 属性，最后默认 MINOR_COUNT
+ * @return      : 1 ~ MINOR_MAX 之间的次设备数量
+ */
+static unsigned int chrdev_minor_count(void)
+{
+    u32 count = minor_count;
+
+    if ((count == 0) && (of_property_read_u32(chrdev.nd, "minor-count", &count) < 0))
+        count = MINOR_COUNT;
+
+    return clamp_t(u32, count, 1, MINOR_MAX);
+}
+
+/* 
+ * @description : 建立第 index 个次设备：缓冲区、cdev、设备节点。
+ *                次设备 0 沿用 DEVICE_NAME，其余为 DEVICE_NAME-<index>。
+ */
+static int chrdev_minor_setup(chrdev_minor_t *minor, unsigned int index)
+{
+    dev_t devt = MKDEV(MAJOR(chrdev.dev_num), MINOR(chrdev.dev_num) + index);
+    int err;
+
+    minor->index = index;
+    minor->stats.pcpu = alloc_percpu(struct cdev_pcpu_stats_t);
+    if (!minor->stats.pcpu)
+        return -ENOMEM;
+    err = cdev_data_init(&minor->dev_data, &minor->stats);
+    if (err)
+        goto fail_data;
+
+    cdev_init(&minor->dev, &fops);
+    minor->dev.owner = THIS_MODULE;
+    err = cdev_add(&minor->dev, devt, 1);
+    if (err < 0) {
+        printk("chrdev_init: 添加第 %u 个 chrdev 字符设备失败！！！\n", index);
+        goto fail_cdev;
+    }
+
+    if (index == 0)
+        minor->dev_device = device_create_with_groups(chrdev.dev_class, NULL, devt, minor,
+                                                      chrdev_minor_groups, DEVICE_NAME);
+    else
+        minor->dev_device = device_create_with_groups(chrdev.dev_class, NULL, devt, minor,
+                                                      chrdev_minor_groups, "%s-%u", DEVICE_NAME, index);
+    if (IS_ERR(minor->dev_device)) {
+        err = PTR_ERR(minor->dev_device);
+        printk(KERN_ERR"创建设备节点失败！错误代码：%d\n", err);
+        goto fail_device;
+    }
+
+    /* debugfs 只用于观测，创建失败不影响设备工作，不检查返回值 */
+    minor->debug_dir = debugfs_create_dir(dev_name(minor->dev_device), debug_root);
+    debugfs_create_file("stats", 0444, minor->debug_dir, minor, &debug_stats_fops);
+    debugfs_create_file("latency", 0444, minor->debug_dir, minor, &debug_latency_fops);
+    debugfs_create_file("hexdump", 0444, minor->debug_dir, minor, &dump_hex_fops);
+    debugfs_create_file("raw", 0444, minor->debug_dir, minor, &dump_raw_fops);
+    debugfs_create_u64("dump_offset", 0644, minor->debug_dir, &minor->dump_off);
+    debugfs_create_u64("dump_length", 0644, minor->debug_dir, &minor->dump_len);
+    return 0;
+
+fail_device:
+    cdev_del(&minor->dev);
+fail_cdev:
+    cdev_data_free(&minor->dev_data);
+fail_data:
+    free_percpu(minor->stats.pcpu);
+    return err;
+}
+
+static void chrdev_minor_teardown(chrdev_minor_t *minor)
+{
+    debugfs_remove_recursive(minor->debug_dir);
+    device_destroy(chrdev.dev_class, minor->dev.dev);
+    cdev_del(&minor->dev);
+    cdev_data_free(&minor->dev_data);
+    free_percpu(minor->stats.pcpu);
+}
 
 static int chrdev_init(void) {
     
     int err = 0;
+    unsigned int i;
+
+    if ((buf_mode < BUF_MODE_FLAT) || (buf_mode > BUF_MODE_PERCPU)) {
+        printk(KERN_ERR "chrdev_init: 不支持的缓冲区模式 buf_mode=%d ！\n", buf_mode);
+        return -EINVAL;
+    }
+    if ((buf_size == 0) || (buf_size > buf_size_max())) {
+        printk(KERN_ERR "chrdev_init: 缓冲区大小 buf_size=%u 越界！\n", buf_size);
+        return -EINVAL;
+    }
+    chrdev.minor_count = chrdev_minor_count();
 
-    /* 1. 申请主设备号：动态申请方式（推荐方式） */
-    if (alloc_chrdev_region(&chrdev.dev_num, MINOR_BASE, MINOR_COUNT, DEVICE_NAME))
+    /* 1. 申请主设备号：动态申请方式（推荐方式），一次申请全部次设备号 */
+    if (alloc_chrdev_region(&chrdev.dev_num, MINOR_BASE, chrdev.minor_count, DEVICE_NAME))
     {
         printk("chrdev_init: 分配 chrdev 的字符设备号操作失败！！！\n");
         err = -ENODEV;
         goto fail_devnum;
     }
-    printk("chrdev_init: 分配主设备号： %d 次设备号： %d 成功。\n", MAJOR(chrdev.dev_num), MINOR(chrdev.dev_num));
+    printk("chrdev_init: 分配主设备号： %d 次设备号： %d 起共 %u 个，成功。\n",
+           MAJOR(chrdev.dev_num), MINOR(chrdev.dev_num), chrdev.minor_count);
     
-    /* 2. 初始化缓冲区 */
-    chrdev.dev_data.buffer = kmalloc(BUF_SIZE, GFP_KERNEL);
-    if (!chrdev.dev_data.buffer) {
+    /* 2. 独立会话用的 slab 缓存 */
+    session_cache = kmem_cache_create("mapleay_chrdev_session", sizeof(struct cdev_private_data_t),
+                                      0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!session_cache) {
         err = -ENOMEM;
-        goto fail_buffer;
+        goto fail_cache;
     }
-    chrdev.dev_data.buf_size = BUF_SIZE;
-    /* kmalloc 成功分配内存后，返回的指针指向的内存区域包含未定义的数据（可能是旧数据或随机值）。 */
-    /* kzalloc 会初始化为0，但性能弱于 kmalloc */
-    memset(chrdev.dev_data.buffer, 0, chrdev.dev_data.buf_size);//可以不用执行
-    chrdev.dev_data.data_len = 0;
-    
-    /* 3. 初始化 cdev 结构体 */
-    cdev_init(&chrdev.dev, &fops);
-    
-    /* 4. 注册 cdev 结构体到 Linux 内核 */
-    if (cdev_add(&chrdev.dev, chrdev.dev_num, MINOR_COUNT) < 0)
-    {
-        printk("chrdev_init: 添加 chrdev 字符设备失败！！！\n");
-        goto fail_cdev;
+
+    /* 每 CPU 模式：登记 CPU 热插拔回调，各缓冲区作为实例挂上来 */
+    if (buf_mode == BUF_MODE_PERCPU) {
+        err = cpuhp_setup_state_multi(CPUHP_AP_ONLINE_DYN, "mapleay_chrdev:online", pcpu_cpu_online, NULL);
+        if (err < 0)
+            goto fail_cpuhp;
+        pcpu_hp_state = err;
+        err = 0;
     }
     
-    /* 5. 创建设备类 */
-    chrdev.dev_class = class_create(THIS_MODULE, CLASS_NAME);
+    /* 3. 创建设备类：所有次设备共用一个类 */
+    chrdev.dev_class = chrdev_class_create(CLASS_NAME);
     if (IS_ERR(chrdev.dev_class))
     {
         err = PTR_ERR(chrdev.dev_class);
@@ -332,26 +3191,36 @@ static int chrdev_init(void) {
         goto fail_class;
     }
     
-    /* 6. 创建设备节点 */
-    chrdev.dev_device = device_create(chrdev.dev_class, NULL, chrdev.dev_num, NULL, DEVICE_NAME);
-    if (IS_ERR(chrdev.dev_device))
-    {
-        err = PTR_ERR(chrdev.dev_device);
-        printk(KERN_ERR"创建设备节点失败！错误代码：%d\n", err);
-        goto fail_device;
+    /* 4. 逐个建立次设备：各自的缓冲区、统计、cdev 、设备节点和 debugfs 目录 */
+    chrdev.minors = kcalloc(chrdev.minor_count, sizeof(*chrdev.minors), GFP_KERNEL);
+    if (!chrdev.minors) {
+        err = -ENOMEM;
+        goto fail_minors;
+    }
+    debug_root = debugfs_create_dir("mapleay-chrdev", NULL);
+    for (i = 0; i < chrdev.minor_count; i++) {
+        err = chrdev_minor_setup(&chrdev.minors[i], i);
+        if (err)
+            goto fail_setup;
     }
     
     printk(KERN_INFO "chrdev_init:Hello Kernel! 模块已加载！\r\n"); 
     return 0;
 
-fail_device:
+fail_setup:
+    while (i--)
+        chrdev_minor_teardown(&chrdev.minors[i]);
+    debugfs_remove_recursive(debug_root);
+    kfree(chrdev.minors);
+fail_minors:
     class_destroy(chrdev.dev_class);
 fail_class:
-    cdev_del(&chrdev.dev);
-fail_cdev:
-    kfree(chrdev.dev_data.buffer);
-fail_buffer:
-    unregister_chrdev_region(chrdev.dev_num, MINOR_COUNT);
+    if (buf_mode == BUF_MODE_PERCPU)
+        cpuhp_remove_multi_state(pcpu_hp_state);
+fail_cpuhp:
+    kmem_cache_destroy(session_cache);
+fail_cache:
+    unregister_chrdev_region(chrdev.dev_num, chrdev.minor_count);
 fail_devnum:
     ;
 
@@ -359,19 +3228,26 @@ fail_devnum:
 }
 
 static void chrdev_exit(void) {
+    unsigned int i;
     
-    /* 1. 销毁设备节点和设备类 */
-    device_destroy(chrdev.dev_class, chrdev.dev_num);
+    /* 1. 销毁各次设备：设备节点、cdev、缓冲区 */
+    for (i = 0; i < chrdev.minor_count; i++)
+        chrdev_minor_teardown(&chrdev.minors[i]);
+    debugfs_remove_recursive(debug_root);
+    kfree(chrdev.minors);
+
+    /* 2. 销毁设备类 */
     class_destroy(chrdev.dev_class);
+
+    /* 每 CPU 模式：实例已随缓冲区全部摘下，注销热插拔状态 */
+    if (buf_mode == BUF_MODE_PERCPU)
+        cpuhp_remove_multi_state(pcpu_hp_state);
     
-    /* 2. 注销cdev */
-    cdev_del(&chrdev.dev);
-    
-    /* 3. 释放设备号 */
-    unregister_chrdev_region(chrdev.dev_num, MINOR_COUNT);
+    /* 3. 释放会话缓存：设备节点已销毁、模块引用已清零，不会再有会话存活 */
+    kmem_cache_destroy(session_cache);
     
-    /* 4. 释放缓冲区 */
-    kfree(chrdev.dev_data.buffer);
+    /* 4. 释放设备号 */
+    unregister_chrdev_region(chrdev.dev_num, chrdev.minor_count);
     
     printk(KERN_INFO "chrdev_exit:Goodbye Kernel! 字符设备模块已卸载！\r\n");
 }
@@ -383,6 +3259,21 @@ static int led_probe(struct platform_device *pdev)
     const char* str;
     struct property *proper;
     
+    /* 经 id_table 匹配到的只能是本模块注册的模拟设备：不碰设备树和物理地址 */
+    if (platform_get_device_id(pdev)) {
+        if (pdev != sim_pdev)
+            return -ENODEV;
+        ret = led_sim_setup(pdev);
+        if (ret) {
+            sim_regs = NULL;    /* 已随 devm 释放 */
+            return ret;
+        }
+        goto regs_ready;
+    }
+
+    /* 模拟模式下不接设备树的真实设备：字符设备只有一套 */
+    if (sim)
+        return -ENODEV;
 
     /* 1. 获取设备节点 */
     chrdev.nd = of_find_node_by_path("/stm32mp1_led");
@@ -425,14 +3316,36 @@ static int led_probe(struct platform_device *pdev)
     }
 
     /* 获取完硬件信息后，开始初始化 LED */ 
-    /* 0. 寄存器地址映射 */ 
+    /* 0. 寄存器地址映射：设备树按寄存器逐个给出地址，GPIOI 的 5 个寄存器同属一组，
+     *    以第 2 项（MODER，组的起始）为基址整组映射一次，其余各项只用来核对偏移。 */
+    if ((regdata[4] != regdata[2] + offsetof(struct stm32_gpio_regs, otyper)) ||
+        (regdata[6] != regdata[2] + offsetof(struct stm32_gpio_regs, ospeedr)) ||
+        (regdata[8] != regdata[2] + offsetof(struct stm32_gpio_regs, pupdr)) ||
+        (regdata[10] != regdata[2] + offsetof(struct stm32_gpio_regs, bsrr))) {
+        printk(KERN_ERR "设备树：GPIOI 各寄存器的地址与寄存器块布局不符！");
+        return -EINVAL;
+    }
     MPU_AHB4_PERIPH_RCC_PI = of_iomap(chrdev.nd, 0);
-    GPIOI_MODER_PI         = of_iomap(chrdev.nd, 1);
-    GPIOI_OTYPER_PI        = of_iomap(chrdev.nd, 2);
-    GPIOI_OSPEEDR_PI       = of_iomap(chrdev.nd, 3);
-    GPIOI_PUPDR_PI         = of_iomap(chrdev.nd, 4);
-    GPIOI_BSRR_PI          = of_iomap(chrdev.nd, 5);
+    GPIOI_PI               = ioremap(regdata[2], sizeof(*GPIOI_PI));
+    if (!MPU_AHB4_PERIPH_RCC_PI || !GPIOI_PI) {
+        printk(KERN_ERR "寄存器地址映射失败！");
+        if (MPU_AHB4_PERIPH_RCC_PI)
+            iounmap(MPU_AHB4_PERIPH_RCC_PI);
+        if (GPIOI_PI)
+            iounmap(GPIOI_PI);
+        return -ENOMEM;
+    }
+    /* 映射好的寄存器交给 regmap 管理，之后的寄存器访问都经过它 */
+    gpioi_map = devm_regmap_init_mmio(&pdev->dev, GPIOI_PI, &gpioi_regmap_cfg);
+    rcc_map   = devm_regmap_init_mmio(&pdev->dev, MPU_AHB4_PERIPH_RCC_PI, &rcc_regmap_cfg);
+    if (IS_ERR(gpioi_map) || IS_ERR(rcc_map)) {
+        ret = IS_ERR(gpioi_map) ? PTR_ERR(gpioi_map) : PTR_ERR(rcc_map);
+        printk(KERN_ERR "regmap 初始化失败：%d\n", ret);
+        led_deinit();
+        return ret;
+    }
 
+regs_ready:
     led_init(); //初始化LED硬件
 
     /* 2. 注册字符设备 */
@@ -440,20 +3353,29 @@ static int led_probe(struct platform_device *pdev)
         led_deinit();
         return -1;
     }
+    if (sim_regs)
+        debugfs_create_file("sim_regs", 0444, debug_root, sim_regs, &debug_sim_regs_fops);
     
     return 0;
 }
 
 static int led_remove(struct platform_device *pdev)
 {
-    /* 0. 注销硬件资源：解除内核中注册的引脚映射 */
-    led_deinit();
+    /* 0. 先注销字符设备：停掉命令环轮询线程、销毁设备节点，之后才不会再有开关灯访问寄存器 */
     chrdev_exit();
+    /* 1. 注销硬件资源：解除内核中注册的引脚映射 */
+    led_deinit();
     printk(KERN_INFO "平台设备驱动框架:platform_driver:led_remove：正在被调用！\n");
     return 0;
 }
 
 
+/* 没有设备树时按名字匹配：sim=1 时本模块在 x86 等平台上注册这个模拟设备 */
+static const struct platform_device_id led_driver_ids[] = {
+    { .name = "mapleay-led-sim", .driver_data = 0, },
+    { } // 终止符
+};
+
 static const struct of_device_id dts_driver_of_match[] = {
     { .compatible = "Mapleay-MP157d-led" }, // 匹配设备树中的 compatible 值
     { } // 终止符
@@ -462,6 +3384,7 @@ static const struct of_device_id dts_driver_of_match[] = {
 static struct platform_driver chrdev_platform_drv = {
     .probe  = led_probe,
     .remove = led_remove,
+    .id_table = led_driver_ids, //模拟设备走 id_table 匹配
     .driver = {
               /* .name 字段：只需要给不匹配的任意字符串即可触发设备树匹配。但是！！
                *             第一：不能不初始化这个字段！！
@@ -469,17 +3392,48 @@ static struct platform_driver chrdev_platform_drv = {
                */
               .name = "not_matched_strs",
               .of_match_table = dts_driver_of_match, //使用设备树方式
+              .pm = &led_pm_ops,                     //挂起/恢复时同步寄存器缓存
+              /* 不允许经 sysfs 手动解绑：解绑时可能还有打开着的 fd，之后的开关灯会访问已解除的映射。
+               * 除此之外 led_remove 只在设备被注销或卸载模块时调用：模拟设备由本模块自己注册、卸载时注销；
+               * 设备树静态描述的设备运行中不会注销（动态移除设备树 overlay 不在考虑范围内）。
+               * 卸载模块时 fops.owner 保证已没有打开者；chrdev_exit 本身并不等待打开者。 */
+              .suppress_bind_attrs = true,
     },
 };
 
 static int __init chrdev_drv_init(void)
 {
-    return platform_driver_register(&chrdev_platform_drv); 
+    int err = platform_driver_register(&chrdev_platform_drv);
+
+    if (err || !sim)
+        return err;
+
+    /* 模拟设备跟着本模块走，卸载模块时才注销。
+     * 先分配、记下指针再添加：添加时当场探测，led_probe 要靠 sim_pdev 认出它 */
+    sim_pdev = platform_device_alloc("mapleay-led-sim", -1);
+    if (!sim_pdev) {
+        err = -ENOMEM;
+        goto fail_alloc;
+    }
+    err = platform_device_add(sim_pdev);
+    if (err)
+        goto fail_add;
+    return 0;
+
+fail_add:
+    platform_device_put(sim_pdev);
+    sim_pdev = NULL;
+fail_alloc:
+    platform_driver_unregister(&chrdev_platform_drv);
+    return err;
 }
 
 static void __exit chrdev_drv_exit(void)
 {
+    if (sim_pdev)
+        platform_device_unregister(sim_pdev);
     platform_driver_unregister(&chrdev_platform_drv);
+    rcu_barrier();  /* 快照模式换下的版本由 call_rcu 释放，等回调跑完再卸载模块 */
 }
 
 module_init(chrdev_drv_init);
@@ -5,22 +5,151 @@
 #define DEVICE_NAME "mapleay-chrdev-device"
 #define CLASS_NAME  "mapleay-chrdev-class"
 #define MINOR_BASE  0     /* 次设备号起始编号为 0 */
-#define MINOR_COUNT 1     /* 次设备号的数量为 1   */
-#define BUF_SIZE    1024  /* 内核缓冲区大小       */
+#define MINOR_COUNT 1     /* 次设备号的默认数量为 1：可用模块参数 minor_count 或设备树 minor-count 覆盖 */
+#define MINOR_MAX   32    /* 次设备号的数量上限   */
+#define BUF_SIZE    1024  /* 内核缓冲区的默认大小：可用模块参数 buf_size 或 RESIZE_BUF 命令修改 */
+#define BUF_SIZE_MAX (64 * 1024 * 1024)  /* 缓冲区大小上限：64MB */
+#define BUF_SIZE_SPARSE_MAX (1024 * 1024 * 1024)  /* 稀疏模式的逻辑大小上限：1GB，只有写过的页占内存 */
+#define LOCK_STRIPES      16  /* 区间锁的条带数：偏移按 1KB 一段轮流落到各条带上 */
+#define LOCK_STRIPE_SHIFT 10  /* 条带粒度：1KB */
+#define CLEAR_CHUNK_SHIFT LOCK_STRIPE_SHIFT  /* 平铺模式惰性清零的块粒度：与条带一致，每块只归一个条带管 */
+#define CLEAR_CHUNK       (1UL << CLEAR_CHUNK_SHIFT)
+
+/* 缓冲区工作模式：模块参数 buf_mode 的取值 */
+#define BUF_MODE_FLAT  0  /* 平铺缓冲区：按文件偏移随机读写（默认） */
+#define BUF_MODE_FIFO  1  /* 环形缓冲区：流式读写，读空/写满时阻塞 */
+#define BUF_MODE_SPARSE 2 /* 稀疏缓冲区：按页首次写入时才分配，空洞读出为零 */
+#define BUF_MODE_SNAPSHOT 3 /* 快照缓冲区：写入生成新版本并以 RCU 发布，读者无锁读到完整的版本 */
+#define BUF_MODE_PERCPU 4 /* 每 CPU 暂存：写者只追加到本 CPU 的记录环，读者按时间戳归并各环 */
+
+#define PCPU_RING_SLOTS 256 /* 每个 CPU 的记录环槽位数：写满后覆盖最旧的记录 */
+#define PCPU_REC_MAX    64  /* 单条记录的最大字节数：一次 write 为一条记录，超出部分为短写 */
+
+/* 带延迟直方图的操作 */
+enum cdev_op {
+    CDEV_OP_READ,
+    CDEV_OP_WRITE,
+    CDEV_OP_IOCTL,
+    CDEV_OP_NR,
+};
+#define LAT_BUCKETS 32  /* 延迟直方图的 log2 桶数：第 i 个桶为 [2^(i-1), 2^i) 纳秒，最后一桶兜底 */
+
+/* 一个 CPU 上的统计：只有本 CPU 累加，读统计文件时才把各 CPU 的值加起来 */
+struct cdev_pcpu_stats_t {
+    unsigned long opens;
+    unsigned long reads;       /* read 调用次数（含失败） */
+    unsigned long writes;      /* write 调用次数（含失败） */
+    unsigned long ioctls;      /* ioctl 与 io_uring 透传命令次数 */
+    u64 bytes_read;
+    u64 bytes_written;
+    unsigned long enospc;      /* 返回 -ENOSPC 的次数 */
+    unsigned long efault;      /* 返回 -EFAULT 的次数 */
+    unsigned long led_switches;  /* 实际操控 LED 的次数 */
+    unsigned long lat[CDEV_OP_NR][LAT_BUCKETS];  /* 各操作的延迟直方图 */
+};
+
+/* 每个次设备的统计信息 */
+struct cdev_stats_t {
+    struct cdev_pcpu_stats_t __percpu *pcpu;
+};
+
+/* 快照模式的一个缓冲区版本：发布后内容不再改变。
+ * 读者持引用读取，最后一个引用放掉后经过 RCU 宽限期才释放。 */
+struct cdev_snap_t {
+    struct kref     ref;
+    struct rcu_head rcu;
+    size_t len;            /* 本版本的有效数据长度 */
+    char   data[];         /* 有效数据，容量为生成该版本时的 buf_size */
+};
+
+/* 每 CPU 模式的一条记录 */
+struct cdev_pcpu_rec_t {
+    u64  ts;               /* 写入时刻（ktime_get_ns，各 CPU 之间可比较）：归并依据 */
+    unsigned int len;
+    char data[PCPU_REC_MAX];
+};
+
+/* 每 CPU 模式下一个 CPU 的记录环：只有本 CPU 的写者追加，合并读者从尾部取走 */
+struct cdev_pcpu_ring_t {
+    spinlock_t   lock;     /* 本 CPU 的写者与合并读者之间；写者之间天然不共享 */
+    unsigned int head;     /* 下一条写入的序号（对槽位数取模即槽位） */
+    unsigned int tail;     /* 下一条读出的序号 */
+    unsigned long dropped; /* 环满时被覆盖的记录数 */
+    struct cdev_pcpu_rec_t *recs;  /* PCPU_RING_SLOTS 个槽位：CPU 上线时在其本地节点上分配 */
+};
+
+#define CHRDEV_RING_RECHECK  (HZ / 10)  /* 轮询线程睡下后多久回来看一眼：用户收割完成项不进内核，没人叫醒它 */
+
+/* 命令环（RING_SETUP）：共享区的布局见 chrdev_ioctl.h */
+struct cdev_cmd_ring_t {
+    void   *mem;           /* 共享区：vzalloc 整页分配，缺页时逐页映射给用户空间 */
+    size_t  size;
+    struct chrdev_ring_hdr *hdr;
+    struct chrdev_sqe *sqes;
+    struct chrdev_cqe *cqes;
+    u32     sq_entries;
+    u32     cq_entries;
+    u32     flags;         /* CHRDEV_RING_SQPOLL */
+    u32     sq_head;       /* 内核自己的游标：不信任共享区里用户改得到的副本 */
+    u32     cq_tail;
+    struct mutex lock;     /* 串行化门铃和轮询线程的消费，也保护下面的暂存区 */
+    struct chrdev_batch_cmd batch[CHRDEV_BATCH_MAX];  /* 一次消费的暂存：交给批量执行 */
+    u64     user_data[CHRDEV_BATCH_MAX];
+    struct task_struct *sqpoll;    /* 轮询线程，没有时为 NULL */
+    struct file        *sqpoll_owner;  /* 起轮询线程的 file：线程随它关闭而停下 */
+    wait_queue_head_t  sqpoll_wq;  /* 轮询线程空闲时睡在这里，RING_ENTER 唤醒 */
+    unsigned long      sq_idle;    /* 空转多久后睡下（jiffies） */
+};
 
 /* 字符设备的自定义私有数据结构 */
 struct cdev_private_data_t {
-    char   *buffer;         /* 内核缓冲区 */
+    char   *buffer;         /* 内核缓冲区：vmalloc 整页分配，可 mmap 到用户空间；稀疏模式下为 NULL */
+    struct xarray pages;   /* 稀疏模式：页号 -> 已写入过的页，未出现的页号即空洞 */
+    struct cdev_snap_t __rcu *snap;  /* 快照模式：当前发布的版本，写者持 lock 替换 */
+    struct cdev_pcpu_ring_t __percpu *pcpu;  /* 每 CPU 模式：各 CPU 的记录环 */
+    struct cdev_cmd_ring_t *ring;    /* 命令环：第一次 RING_SETUP 时建立，随缓冲区一起释放 */
+    struct hlist_node cpuhp_node;    /* 每 CPU 模式：挂在 CPU 热插拔多实例状态上 */
     size_t buf_size;       /* 缓冲区大小: 写依据此变量  */
-    size_t data_len;       /* 当前数据长度：读依据此变量 */
+    size_t data_len;       /* 当前数据长度：读依据此变量；FIFO 模式下为环中现存字节数 */
+    u64    wr_gen;         /* 写代数：元数据每被写入路径改动一次加一 */
+    seqlock_t meta_lock;   /* 发布 buf_size/data_len/wr_gen：查询方无锁读取一致的快照 */
+    u32   *chunk_gen;      /* 平铺模式：每块（CLEAR_CHUNK 字节）最近一次清零时的清空代数 */
+    u32    clear_gen;      /* 平铺模式：清空代数，CLEAR_BUF 加一；块代数与之不等的块内容作废，读作全零 */
+    size_t head;           /* FIFO 模式：下一次写入的位置 */
+    size_t tail;           /* FIFO 模式：下一次读出的位置 */
+    struct mutex lock;     /* FIFO 模式：保护 head/tail/data_len；快照模式：串行化生成新版本的写者；
+                              每 CPU 模式：串行化合并读者 */
+    struct rw_semaphore resize_sem;  /* 平铺模式的读写和控制命令共享持有，调整缓冲区大小时独占 */
+    struct rw_semaphore stripes[LOCK_STRIPES];  /* 平铺/稀疏模式的区间锁：读共享、写独占，互不重叠的区间可并行 */
+    atomic_t mmap_count;   /* 现存的 mmap 映射数：映射期间不允许调整大小 */
+    wait_queue_head_t rd_wq;  /* FIFO 模式：等待数据的读者 */
+    wait_queue_head_t wr_wq;  /* FIFO 模式：等待空间的写者 */
+    struct list_head  aio_list;  /* FIFO 模式：挂起的异步读（AIO） */
+    struct list_head  aio_cancelled;  /* FIFO 模式：已取消、等完成工作以 -ECANCELED 完成的异步读 */
+    spinlock_t        aio_lock;  /* FIFO 模式：保护上面两个队列；取消回调在 aio 的关中断自旋锁内调用，不能拿 lock；
+                                    ctx_lock 也在中断上下文的完成路径里拿，所以这把锁一律关中断拿 */
+    struct work_struct aio_work; /* FIFO 模式：生产者触发的异步读完成工作 */
+    bool   per_open;       /* 是否为 open 时单独分配的会话（release 时释放） */
+    struct cdev_stats_t *stats;  /* 所属次设备的统计 */
 };
 
-typedef struct chrdev_object {
+/* 次设备对象：每个次设备有独立的 cdev、设备节点、缓冲区和统计 */
+typedef struct chrdev_minor_object {
     struct cdev   dev;
-    struct class  *dev_class;
     struct device *dev_device;
     struct cdev_private_data_t dev_data;
-    dev_t  dev_num;
+    struct cdev_stats_t stats;
+    struct dentry *debug_dir;  /* debugfs 目录：<debugfs>/mapleay-chrdev/<设备名>/ */
+    u64 dump_off;          /* debugfs 转储窗口的起点 */
+    u64 dump_len;          /* debugfs 转储窗口的长度：0 表示直到数据末尾 */
+    unsigned int  index;   /* 次设备序号：0 ~ minor_count-1 */
+}chrdev_minor_t;
+
+typedef struct chrdev_object {
+    struct class  *dev_class;
+    dev_t  dev_num;                /* 起始设备号 */
+    unsigned int   minor_count;    /* 次设备数量 */
+    chrdev_minor_t *minors;        /* 次设备数组，按次设备序号索引 */
 	struct device_node *nd;  /* 设备节点 2025年4月17日15:04:27 */
 }chrdev_t;
 
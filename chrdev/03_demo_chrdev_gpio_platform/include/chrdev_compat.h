@@ -0,0 +1,107 @@
+#ifndef __CHRDEV_COMPAT_H__
+#define __CHRDEV_COMPAT_H__
+
+/*
+ * 内核版本兼容层：开发板内核是 5.4.31，io_uring 的 uring_cmd 透传要到 6.0 才稳定，
+ * 中间几个被驱动用到的接口改过名或改过签名，统一在这里按版本号选择。
+ * （6.11 起 platform_driver.remove 改为返回 void，不在覆盖范围内。）
+ */
+#include <linux/version.h>
+
+/* 5.8 起 use_mm/unuse_mm 更名为 kthread_use_mm/kthread_unuse_mm */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+#include <linux/kthread.h>
+#define chrdev_use_mm(mm)    kthread_use_mm(mm)
+#define chrdev_unuse_mm(mm)  kthread_unuse_mm(mm)
+#else
+#include <linux/mmu_context.h>
+#define chrdev_use_mm(mm)    use_mm(mm)
+#define chrdev_unuse_mm(mm)  unuse_mm(mm)
+#endif
+
+/* 5.10 起 regmap-mmio 可以改用不带屏障的 _relaxed 访问 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+#define CHRDEV_HAVE_REGMAP_RELAXED_MMIO
+#endif
+
+/* 5.16 起 ki_complete 去掉了第三个参数 res2 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+#define chrdev_ki_complete(iocb, res)  ((iocb)->ki_complete((iocb), (res)))
+#else
+#define chrdev_ki_complete(iocb, res)  ((iocb)->ki_complete((iocb), (res), 0))
+#endif
+
+/* 6.0 起有 ITER_UBUF（单段用户缓冲区，io_uring 读和 6.4 起的单段 AIO 读都用它）：
+ * 判断迭代器是否指向用户内存要用 user_backed_iter；dup_iter 不认识它，
+ * 它也没有段数组要复制，照搬结构体即可（ZERO_SIZE_PTR 可以直接 kfree） */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#include <linux/uio.h>
+#include <linux/slab.h>
+#define chrdev_user_backed_iter(i)  user_backed_iter(i)
+static inline const void *chrdev_dup_iter(struct iov_iter *new, struct iov_iter *old, gfp_t gfp)
+{
+    if (iter_is_ubuf(old)) {
+        *new = *old;
+        return ZERO_SIZE_PTR;
+    }
+    return dup_iter(new, old, gfp);
+}
+#else
+#define chrdev_user_backed_iter(i)  iter_is_iovec(i)
+#define chrdev_dup_iter(new, old, gfp)  dup_iter((new), (old), (gfp))
+#endif
+
+/* 取消回调只能挂在经 fs/aio.c 提交的请求上（kiocb 嵌在 aio_kiocb 里），挂到 io_uring 的 kiocb 上会踩内存。
+ * IOCB_AIO_RW（6.8 起，也回合进了各稳定分支）直接标出这类请求；没有它的旧内核只能看提交上下文：
+ * io_submit 在调用者进程里发起，io_uring 会阻塞的重试在 io-wq 工作线程里（5.12 起为 PF_IO_WORKER，之前是内核线程） */
+#include <linux/fs.h>
+#include <linux/sched.h>
+#ifdef IOCB_AIO_RW
+#define chrdev_kiocb_is_aio(iocb)  ((iocb)->ki_flags & IOCB_AIO_RW)
+#else
+#ifdef PF_IO_WORKER
+#define CHRDEV_PF_IO_WORKER  PF_IO_WORKER
+#else
+#define CHRDEV_PF_IO_WORKER  0
+#endif
+#define chrdev_kiocb_is_aio(iocb)  (!(current->flags & (PF_KTHREAD | CHRDEV_PF_IO_WORKER)))
+#endif
+
+/* 6.3 起 vma->vm_flags 只读，须经 vm_flags_set 修改 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+#define chrdev_vm_flags_set(vma, flags)  vm_flags_set((vma), (flags))
+#else
+#define chrdev_vm_flags_set(vma, flags)  ((vma)->vm_flags |= (flags))
+#endif
+
+/* 6.4 起 class_create 不再需要 owner 参数 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define chrdev_class_create(name)  class_create(name)
+#else
+#define chrdev_class_create(name)  class_create(THIS_MODULE, name)
+#endif
+
+/* 6.5 起 generic_file_splice_read 被移除，非页缓存文件改用 copy_splice_read */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define chrdev_splice_read  copy_splice_read
+#else
+#define chrdev_splice_read  generic_file_splice_read
+#endif
+
+/* io_uring 的 uring_cmd 透传：6.0 起回调签名为 (ioucmd, issue_flags)；
+ * 6.6 起参数区改由 io_uring_sqe_cmd() 取得，6.7 起声明移到 <linux/io_uring/cmd.h> */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#define CHRDEV_HAVE_URING_CMD
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+#define chrdev_uring_cmd_payload(ioucmd)  io_uring_sqe_cmd((ioucmd)->sqe)
+#else
+#define chrdev_uring_cmd_payload(ioucmd)  ((ioucmd)->cmd)
+#endif
+#endif
+
+#endif
@@ -1,12 +1,108 @@
 #ifndef __CHRDEV_IOCTL_H__
 #define __CHRDEV_IOCTL_H__
 
+#include <linux/types.h>
+
 #define CHRDEV_IOC_MAGIC   'k'
 #define CLEAR_BUF              _IO(CHRDEV_IOC_MAGIC, 0)
 #define GET_BUF_SIZE           _IOR(CHRDEV_IOC_MAGIC, 1, int)
 #define GET_DATA_LEN           _IOR(CHRDEV_IOC_MAGIC, 2, int)
 #define MAPLEAY_UPDATE_DAT_LEN _IOWR(CHRDEV_IOC_MAGIC, 3, int)
 #define PRINT_BUF_DATA         _IO(CHRDEV_IOC_MAGIC, 4)
-#define CHRDEV_IOC_MAXNR    4
+#define RESIZE_BUF             _IOW(CHRDEV_IOC_MAGIC, 5, int)  /* 调整缓冲区大小，保留现有数据 */
+#define GET_META               _IOR(CHRDEV_IOC_MAGIC, 6, struct chrdev_meta)  /* 一致的元数据快照，仅 ioctl */
+#define BATCH_EXEC             _IOWR(CHRDEV_IOC_MAGIC, 7, struct chrdev_batch) /* 一次执行一组命令，仅 ioctl */
+#define LED_SET                _IOW(CHRDEV_IOC_MAGIC, 8, int)  /* 开关灯：LEDON/LEDOFF */
+#define RING_SETUP             _IOWR(CHRDEV_IOC_MAGIC, 9, struct chrdev_ring_params) /* 建立命令环，仅 ioctl */
+#define RING_ENTER             _IO(CHRDEV_IOC_MAGIC, 10)  /* 门铃：消费提交环，返回本次消费的条数，仅 ioctl */
+#define LED_GET                _IOR(CHRDEV_IOC_MAGIC, 11, int)  /* 读 LED 状态（驱动里的影子，不访问硬件） */
+#define CHRDEV_IOC_MAXNR    11
+
+#define CHRDEV_BATCH_MAX        64         /* 一批最多的命令条数 */
+#define CHRDEV_BATCH_STOP_ON_ERR (1U << 0) /* 遇到第一条失败的命令就停下 */
+
+/* GET_META 的结果：三者取自同一时刻，调整大小或清空期间也不会读到新旧混杂的组合 */
+struct chrdev_meta {
+    __u64 buf_size;   /* 缓冲区大小 */
+    __u64 data_len;   /* 当前数据长度 */
+    __u64 wr_gen;     /* 写代数：每次写入、清空、调整大小、登记长度都加一 */
+};
+
+/* BATCH_EXEC 的一条命令：cmd 为上面参数是 int 的命令号 */
+struct chrdev_batch_cmd {
+    __u32 cmd;
+    __s32 arg;        /* 写方向命令的参数；读方向命令执行后为结果 */
+    __s32 result;     /* 执行结果：0 成功，负数错误码 */
+    __u32 rsvd;
+};
+
+/* BATCH_EXEC 的参数：cmds 指向 count 条 struct chrdev_batch_cmd 的数组 */
+struct chrdev_batch {
+    __u64 cmds;       /* 用户空间指针 */
+    __u32 count;      /* 1 ~ CHRDEV_BATCH_MAX */
+    __u32 flags;      /* CHRDEV_BATCH_STOP_ON_ERR */
+    __u32 done;       /* 返回：实际执行了的条数（含停下的那一条） */
+    __u32 rsvd;
+};
+
+/* 
+ * 命令环：一块 mmap 到用户空间的共享内存，头部之后是提交环（SQ）和完成环（CQ）。
+ * 用户填好 SQE 后以 release 语义推进 sq_tail，内核消费后推进 sq_head，并按同样顺序在 CQ 里写回结果。
+ * 没有轮询线程时用 RING_ENTER 敲门铃；有轮询线程（CHRDEV_RING_SQPOLL）时只在 flags 里
+ * 出现 CHRDEV_RING_NEED_WAKEUP（线程空闲睡下了）时才需要敲。完成环满了线程也会睡下，
+ * 收割之后看到 NEED_WAKEUP 就敲一下门铃，否则线程要过一会儿（约 100ms）才自行察觉。
+ * 环跟着缓冲区走，多个生产者须自行互斥。
+ */
+#define CHRDEV_RING_MMAP_OFF    0x10000000  /* mmap 的偏移：超过缓冲区大小上限，与缓冲区的映射区分开 */
+#define CHRDEV_RING_MAX_ENTRIES 4096
+#define CHRDEV_RING_SQPOLL      (1U << 0)   /* RING_SETUP：起一个内核线程轮询提交环，线程随建立它的 fd 关闭而停下 */
+#define CHRDEV_RING_IDLE_MS     10          /* 轮询线程空转多久后睡下的默认值（毫秒） */
+#define CHRDEV_RING_MAX_IDLE_MS 100         /* 上限：更大的值按上限算，空转期间线程独占一个 CPU */
+#define CHRDEV_RING_NEED_WAKEUP (1U << 0)   /* 环头 flags：轮询线程睡下了，提交后须 RING_ENTER 唤醒 */
+
+/* 环头：sq_tail、cq_head 由用户推进，其余由内核维护 */
+struct chrdev_ring_hdr {
+    __u32 sq_head;
+    __u32 sq_tail;
+    __u32 cq_head;
+    __u32 cq_tail;
+    __u32 sq_mask;
+    __u32 cq_mask;
+    __u32 flags;      /* CHRDEV_RING_NEED_WAKEUP */
+    __u32 rsvd;
+};
+
+/* 提交项：cmd 为参数是 int 的命令号（同 BATCH_EXEC） */
+struct chrdev_sqe {
+    __u32 cmd;
+    __s32 arg;
+    __u64 user_data;  /* 原样带回完成项 */
+};
+
+/* 完成项：与提交项一一对应，顺序相同 */
+struct chrdev_cqe {
+    __u64 user_data;
+    __s32 res;        /* 0 成功，负数错误码 */
+    __s32 arg;        /* 读方向命令的结果 */
+};
+
+/* RING_SETUP 的参数：环已经建立时不再新建，直接报告现有环的参数 */
+struct chrdev_ring_params {
+    __u32 sq_entries;  /* 入：提交环条数，向上取 2 的幂，1~CHRDEV_RING_MAX_ENTRIES；出：实际条数 */
+    __u32 cq_entries;  /* 入：0 取提交环的两倍；出：实际条数 */
+    __u32 flags;       /* CHRDEV_RING_SQPOLL */
+    __u32 sq_idle_ms;  /* 入：轮询线程空转多久后睡下，0 取 CHRDEV_RING_IDLE_MS，最多 CHRDEV_RING_MAX_IDLE_MS；出：实际值 */
+    __u32 sq_off;      /* 出：SQE 数组在映射区里的偏移（环头在偏移 0） */
+    __u32 cq_off;      /* 出：CQE 数组的偏移 */
+    __u32 ring_size;   /* 出：要 mmap 的字节数，偏移用 CHRDEV_RING_MMAP_OFF */
+    __u32 rsvd;
+};
+
+/* io_uring 透传（IORING_OP_URING_CMD）的参数区：放在 SQE 的 cmd 字段里，最多 16 字节。
+ * cmd_op 填上面的 ioctl 命令号；写方向命令的参数放 arg，读方向命令的结果在 CQE 的 res 里。 */
+struct chrdev_uring_cmd {
+    int arg;
+    int rsvd[3];
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+/*
+ * 字符设备驱动的跟踪点（tracepoint）：取代读写路径上逐次调用的 printk。
+ * 未开启时每个跟踪点只是一条不跳转的空指令（static key），开启后以二进制记录写入 ftrace 环形缓冲区，
+ * 不做字符串格式化，也不刷 dmesg。进程号由每条事件自带的 common_pid 记录。
+ *
+ * 用法：
+ *   echo 1 > /sys/kernel/debug/tracing/events/mapleay_chrdev/enable
+ *   cat /sys/kernel/debug/tracing/trace_pipe
+ * 或：perf record -e 'mapleay_chrdev:*' -a
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mapleay_chrdev
+
+#if !defined(__CHRDEV_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __CHRDEV_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(chrdev_open,
+    TP_PROTO(unsigned int minor, unsigned int f_flags),
+    TP_ARGS(minor, f_flags),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, f_flags)
+    ),
+    TP_fast_assign(
+        __entry->minor   = minor;
+        __entry->f_flags = f_flags;
+    ),
+    TP_printk("minor=%u flags=%#x", __entry->minor, __entry->f_flags)
+);
+
+TRACE_EVENT(chrdev_release,
+    TP_PROTO(unsigned int minor),
+    TP_ARGS(minor),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+    ),
+    TP_printk("minor=%u", __entry->minor)
+);
+
+/* 读写共用：pos 为操作前的偏移（流式模式恒为 0），len 为请求长度，ret 为实际字节数或错误码 */
+DECLARE_EVENT_CLASS(chrdev_rw,
+    TP_PROTO(loff_t pos, size_t len, ssize_t ret),
+    TP_ARGS(pos, len, ret),
+    TP_STRUCT__entry(
+        __field(loff_t,  pos)
+        __field(size_t,  len)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->pos = pos;
+        __entry->len = len;
+        __entry->ret = ret;
+    ),
+    TP_printk("pos=%lld len=%zu ret=%zd", __entry->pos, __entry->len, __entry->ret)
+);
+
+DEFINE_EVENT(chrdev_rw, chrdev_read,
+    TP_PROTO(loff_t pos, size_t len, ssize_t ret),
+    TP_ARGS(pos, len, ret)
+);
+
+DEFINE_EVENT(chrdev_rw, chrdev_write,
+    TP_PROTO(loff_t pos, size_t len, ssize_t ret),
+    TP_ARGS(pos, len, ret)
+);
+
+TRACE_EVENT(chrdev_llseek,
+    TP_PROTO(loff_t offset, int whence, loff_t ret),
+    TP_ARGS(offset, whence, ret),
+    TP_STRUCT__entry(
+        __field(loff_t, offset)
+        __field(int,    whence)
+        __field(loff_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->offset = offset;
+        __entry->whence = whence;
+        __entry->ret    = ret;
+    ),
+    TP_printk("offset=%lld whence=%s ret=%lld", __entry->offset,
+              __print_symbolic(__entry->whence,
+                               { SEEK_SET, "SET" }, { SEEK_CUR, "CUR" }, { SEEK_END, "END" },
+                               { SEEK_DATA, "DATA" }, { SEEK_HOLE, "HOLE" }),
+              __entry->ret)
+);
+
+/* ioctl 与 io_uring 透传共用：val 为写方向的参数或读方向的结果 */
+TRACE_EVENT(chrdev_ioctl,
+    TP_PROTO(unsigned int cmd, int val, long ret),
+    TP_ARGS(cmd, val, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, cmd)
+        __field(int,          val)
+        __field(long,         ret)
+    ),
+    TP_fast_assign(
+        __entry->cmd = cmd;
+        __entry->val = val;
+        __entry->ret = ret;
+    ),
+    TP_printk("nr=%u val=%d ret=%ld", _IOC_NR(__entry->cmd), __entry->val, __entry->ret)
+);
+
+/* LED 实际切换：状态没变或参数非法时不触发 */
+TRACE_EVENT(chrdev_led_switch,
+    TP_PROTO(u8 sta),
+    TP_ARGS(sta),
+    TP_STRUCT__entry(
+        __field(u8, sta)
+    ),
+    TP_fast_assign(
+        __entry->sta = sta;
+    ),
+    TP_printk("led=%s", __entry->sta ? "on" : "off")
+);
+
+#endif /* __CHRDEV_TRACE_H__ */
+
+/* 头文件在模块自己的 include 目录里（Makefile 的 ccflags-y 已加入搜索路径），不在内核的 include/trace/ 下 */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE chrdev_trace
+#include <trace/define_trace.h>
@@ -1,13 +1,35 @@
+#define _GNU_SOURCE   /* splice()、pthread_setaffinity_np() */
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <stdlib.h>
+#include <sys/mman.h> /* mmap() */
+#include <poll.h>     /* poll() */
+#include <sys/uio.h>  /* readv()/writev() */
+#include <time.h>     /* clock_gettime() */
+#include <errno.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h> /* Linux 原生 AIO：io_setup/io_submit/io_getevents */
+#include <linux/io_uring.h> /* io_uring：IORING_OP_URING_CMD 控制命令透传 */
+#include <pthread.h>
 #include "chrdev_ioctl.h"
 
 #define DEVICE_FILE "/dev/mapleay-chrdev-device"
 #define MAX_INPUT_LEN 128
+#define SG_MAX_SEGS   64      /* 分散聚集基准的最大分段数 */
+#define BENCH_ROUNDS  10000   /* 基准测试的轮数 */
+#define RING_ENTRIES  256     /* 命令环基准的提交环条数 */
+#define INSTRUMENT_PARAM "/sys/module/chrdev_platfrom_driver/parameters/instrument"  /* 驱动的插桩开关 */
+#define SIM_REGS_DEBUGFS "/sys/kernel/debug/mapleay-chrdev/sim_regs"  /* 模拟寄存器的值与读写次数 */
+#define AIO_MAX_REQS  64      /* 异步读演示的最大请求数：64 x 16 字节正好填满 1KB 环 */
+#define AIO_REQ_LEN   16
+#define URING_MAX_BATCH 64    /* io_uring 基准每次提交的最大命令数 */
+#define MT_MAX_THREADS  16    /* 并发写基准的最大线程数：与驱动的区间锁条带数一致 */
+#define MT_REGION       1024  /* 每个线程独占的区间大小：正好一个条带 */
+#define PCPU_REC_LEN    16    /* 每 CPU 基准的记录长度 */
 
 void print_usage() {
     printf("\n支持的命令：\n");
@@ -18,20 +40,815 @@ void print_usage() {
     printf("  buf_size          获取缓冲区大小\n");
     printf("  data_len          获取当前数据长度\n");
     printf("  update_len <长度> 更新数据长度\n");
-    printf("  p                 请内核中打印缓冲区数据\n");
+    printf("  meta              获取一致的元数据快照：缓冲区大小、数据长度、写代数\n");
+    printf("  p                 请内核打印一行数据概要；内容用 debugfs 的 hexdump/raw 查看\n");
+    printf("  resize <字节数>   调整缓冲区大小，保留现有数据（映射期间不可调整）\n");
+    printf("  extents           用 SEEK_DATA/SEEK_HOLE 列出数据段和空洞（稀疏模式 buf_mode=2）\n");
+    printf("  mt  <线程数>      并发写基准：1~N 个线程各自 pwrite 互不重叠的区间，看吞吐随线程数的变化\n");
+    printf("  pcpu <线程数>     每 CPU 模式（buf_mode=4）：1~N 个绑核生产者写记录的吞吐，并校验归并读出的顺序\n");
+    printf("  instr <轮数>      插桩开销基准：插桩关闭/打开时 1 字节读写的每轮耗时（需要 root）\n");
+    printf("  mw  <string>      经 mmap 直接写入缓冲区并登记数据长度\n");
+    printf("  mr                经 mmap 直接读出缓冲区的有效数据\n");
+    printf("  poll <毫秒>       等待设备可读后再读取（FIFO 模式 buf_mode=1）\n");
+    printf("  sg  <分段数>      分散聚集基准：writev/readv 一次搬运 对比 逐段 write/read\n");
+    printf("  splice <文件>     设备→管道→文件 的 splice 搬运，对比 read/write 循环的 MB/s\n");
+    printf("  aio <请求数>      FIFO 模式：先挂起多个异步读，再写入数据由内核逐个完成\n");
+    printf("  uring <批量>      io_uring 批量提交 GET_DATA_LEN 控制命令，对比逐个 ioctl（内核 >= 6.0）\n");
+    printf("  batch <轮数>      批量控制基准：清空→登记长度→查询长度→关灯 一次 BATCH_EXEC 对比 逐条 ioctl\n");
+    printf("  led <0|1>         直接关灯/开灯（LED_SET）\n");
+    printf("  led_get           读 LED 状态（驱动里的影子，不访问硬件）\n");
+    printf("  ledbench <次数>   开关灯吞吐：交替 LED_SET 开/关，模拟寄存器（sim=1）下附带各寄存器的访问次数\n");
+    printf("  ring <条数>       命令环基准：经共享内存提交开关灯命令、敲门铃消费，对比逐条 write\n");
+    printf("  ringpoll <条数>   同上，由内核轮询线程消费，线程睡下时才敲门铃\n");
     printf("  help              显示帮助信息\n");
     printf("  exit              退出程序\n");
     printf(">> ");
     fflush(stdout);
 }
 
-int main() {
+/* 把设备缓冲区映射进来：零拷贝，读写都直接落在内核缓冲区上。失败返回 NULL */
+char *map_device(int fd, int *buf_size) {
+    if (ioctl(fd, GET_BUF_SIZE, buf_size) < 0) {
+        perror("获取缓冲区大小失败");
+        return NULL;
+    }
+    char *map = mmap(NULL, *buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("映射设备缓冲区失败");
+        return NULL;
+    }
+    return map;
+}
+
+/* 单调时钟，单位：纳秒 */
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* 回到缓冲区开头：FIFO 模式不可定位（ESPIPE），忽略即可 */
+int rewind_device(int fd) {
+    if ((lseek(fd, 0, SEEK_SET) < 0) && (errno != ESPIPE)) {
+        perror("更新文件位置失败");
+        return -1;
+    }
+    return 0;
+}
+
+/* 用 SEEK_DATA/SEEK_HOLE 逐段列出设备中的数据段与空洞，结束后回到开头 */
+void print_extents(int fd) {
+    off_t data = 0, hole;
+    int len, nr = 0;
+
+    if (ioctl(fd, GET_DATA_LEN, &len) < 0) {
+        perror("获取数据长度失败");
+        return;
+    }
+    while ((data = lseek(fd, data, SEEK_DATA)) >= 0) {
+        hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            perror("SEEK_HOLE 失败");
+            break;
+        }
+        printf("  数据段 %d：[%lld, %lld) 共 %lld 字节\n", nr++, (long long)data, (long long)hole, (long long)(hole - data));
+        data = hole;
+    }
+    if ((data < 0) && (errno != ENXIO)) {
+        perror("SEEK_DATA 失败");
+    }
+    printf("有效数据长度 %d 字节，共 %d 个数据段，其余为空洞\n", len, nr);
+    rewind_device(fd);
+}
+
+/* 
+ * 分散/聚集基准：把缓冲区等分成 nseg 段（例如报文头 + 多段负载），
+ * 同样的数据分别用 writev/readv 一次系统调用搬运，与逐段 write/read 对比耗时。
+ */
+void bench_sg(int fd, int nseg) {
+    static char seg_buf[SG_MAX_SEGS][1024];
+    struct iovec iov[SG_MAX_SEGS];
+    int size;
+    long long t0, t_vec, t_loop;
+
+    if ((nseg < 1) || (nseg > SG_MAX_SEGS)) {
+        printf("错误：分段数须在 1~%d 之间\n", SG_MAX_SEGS);
+        return;
+    }
+    if (ioctl(fd, GET_BUF_SIZE, &size) < 0) {
+        perror("获取缓冲区大小失败");
+        return;
+    }
+    int seg_len = size / nseg;
+    if (seg_len > (int)sizeof(seg_buf[0])) {
+        seg_len = sizeof(seg_buf[0]);
+    }
+    for (int i = 0; i < nseg; i++) {
+        memset(seg_buf[i], i, seg_len);
+        iov[i].iov_base = seg_buf[i];
+        iov[i].iov_len  = seg_len;
+    }
+    seg_buf[0][0] = 0; /* 首字节保持关灯，避免基准过程中 LED 闪烁 */
+
+    t0 = now_ns();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        if (rewind_device(fd) || (writev(fd, iov, nseg) < 0) ||
+            rewind_device(fd) || (readv(fd, iov, nseg) < 0)) {
+            perror("writev/readv 失败");
+            return;
+        }
+    }
+    t_vec = now_ns() - t0;
+
+    t0 = now_ns();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        if (rewind_device(fd)) {
+            return;
+        }
+        for (int i = 0; i < nseg; i++) {
+            if (write(fd, seg_buf[i], seg_len) < 0) {
+                perror("write 失败");
+                return;
+            }
+        }
+        if (rewind_device(fd)) {
+            return;
+        }
+        for (int i = 0; i < nseg; i++) {
+            if (read(fd, seg_buf[i], seg_len) < 0) {
+                perror("read 失败");
+                return;
+            }
+        }
+    }
+    t_loop = now_ns() - t0;
+
+    printf("分散聚集基准：%d 段 x %d 字节，%d 轮\n", nseg, seg_len, BENCH_ROUNDS);
+    printf("  writev/readv ：每轮 %.2f us\n", t_vec / 1000.0 / BENCH_ROUNDS);
+    printf("  逐段 write/read：每轮 %.2f us\n", t_loop / 1000.0 / BENCH_ROUNDS);
+    printf("  加速比：%.2f\n", (double)t_loop / t_vec);
+}
+
+/* 切换驱动的插桩开关（static key），返回 0 成功；需要 root */
+int set_instrument(int on) {
+    int pfd = open(INSTRUMENT_PARAM, O_WRONLY);
+    int ok;
+
+    if (pfd < 0) {
+        return -1;
+    }
+    ok = (write(pfd, on ? "1" : "0", 1) == 1);
+    close(pfd);
+    return ok ? 0 : -1;
+}
+
+/* 一轮 = 1 字节 pwrite（交替开关灯，包含 MMIO 写）+ 1 字节 pread，返回每轮纳秒数 */
+double instr_rounds(int fd, int rounds) {
+    char c;
+    long long t0 = now_ns();
+
+    for (int r = 0; r < rounds; r++) {
+        c = r & 1;
+        if ((pwrite(fd, &c, 1, 0) != 1) || (pread(fd, &c, 1, 0) != 1)) {
+            perror("pwrite/pread 失败");
+            return -1;
+        }
+    }
+    return (double)(now_ns() - t0) / rounds;
+}
+
+/* 插桩开销基准：同一负载在插桩关闭/打开时各跑一遍（平铺模式 buf_mode=0） */
+void bench_instr(int fd, int rounds) {
+    double t_off, t_on;
+
+    if (rounds < 1) {
+        rounds = BENCH_ROUNDS;
+    }
+    if (set_instrument(0) < 0) {
+        perror("切换插桩开关失败（需要 root 和 " INSTRUMENT_PARAM "）");
+        return;
+    }
+    t_off = instr_rounds(fd, rounds);
+    set_instrument(1);
+    t_on = instr_rounds(fd, rounds);
+    set_instrument(0);
+    if ((t_off < 0) || (t_on < 0)) {
+        return;
+    }
+
+    printf("插桩开销基准：%d 轮 1 字节写（含开关灯）+ 1 字节读\n", rounds);
+    printf("  插桩关闭：每轮 %.0f ns\n", t_off);
+    printf("  插桩打开：每轮 %.0f ns\n", t_on);
+    printf("  开销：每轮 %.0f ns（%.1f%%）\n", t_on - t_off, (t_on - t_off) * 100.0 / t_off);
+}
+
+/* 把缓冲区写满测试数据，返回写入字节数；首字节为 0，保持关灯 */
+int fill_device(int fd, int size) {
+    static char pattern[1 << 16];
+    if (size > (int)sizeof(pattern)) {
+        size = sizeof(pattern);
+    }
+    memset(pattern, 'M', size);
+    pattern[0] = 0;
+    if (rewind_device(fd)) {
+        return -1;
+    }
+    return write(fd, pattern, size);
+}
+
+/* 
+ * splice 基准：设备内容 → 管道 → 文件，全程在内核里搬运页面；
+ * 对照组为传统的 read 到用户缓冲区、再 write 到文件的循环（两次拷贝）。
+ * FIFO 模式读出即消费，所以每轮都重新灌满设备，两组对等计入。
+ */
+void bench_splice(int fd, const char *path) {
+    static char bounce[1 << 16];
+    int size, pipefd[2];
+    long long t0, t_splice = 0, t_copy = 0, moved = 0;
+    int is_fifo = (lseek(fd, 0, SEEK_SET) < 0) && (errno == ESPIPE);
+
+    if (ioctl(fd, GET_BUF_SIZE, &size) < 0) {
+        perror("获取缓冲区大小失败");
+        return;
+    }
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        perror("打开输出文件失败");
+        return;
+    }
+    if (pipe(pipefd) < 0) {
+        perror("创建管道失败");
+        close(out);
+        return;
+    }
+    if (!is_fifo && (fill_device(fd, size) < 0)) {
+        perror("灌入测试数据失败");
+        goto out;
+    }
+
+    for (int r = 0; r < BENCH_ROUNDS / 10; r++) {
+        if ((is_fifo && (fill_device(fd, size) < 0)) || rewind_device(fd)) {
+            goto out;
+        }
+        t0 = now_ns();
+        ssize_t n = splice(fd, NULL, pipefd[1], NULL, size, SPLICE_F_MOVE);
+        while (n > 0) {
+            ssize_t m = splice(pipefd[0], NULL, out, NULL, n, SPLICE_F_MOVE);
+            if (m <= 0) {
+                perror("splice 管道→文件 失败");
+                goto out;
+            }
+            n -= m;
+            moved += m;
+        }
+        if (n < 0) {
+            perror("splice 设备→管道 失败");
+            goto out;
+        }
+        t_splice += now_ns() - t0;
+
+        if ((is_fifo && (fill_device(fd, size) < 0)) || rewind_device(fd)) {
+            goto out;
+        }
+        t0 = now_ns();
+        n = read(fd, bounce, size);
+        if ((n < 0) || (write(out, bounce, n) != n)) {
+            perror("read/write 循环失败");
+            goto out;
+        }
+        t_copy += now_ns() - t0;
+    }
+
+    printf("splice 基准：共搬运 %lld 字节\n", moved);
+    printf("  splice 设备→管道→文件：%.2f MB/s\n", moved * 1000.0 / t_splice);
+    printf("  read/write 循环     ：%.2f MB/s\n", moved * 1000.0 / t_copy);
+out:
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(out);
+}
+
+/* 
+ * 异步读演示（FIFO 模式 buf_mode=1）：一次 io_submit 挂起 nreq 个读请求，
+ * 驱动立即返回（不占线程等待）；随后一次 write 送入数据，由驱动的生产者路径完成全部请求。
+ */
+void demo_aio(int fd, int nreq) {
+    static char bufs[AIO_MAX_REQS][AIO_REQ_LEN];
+    static char payload[AIO_MAX_REQS * AIO_REQ_LEN];
+    struct iocb cbs[AIO_MAX_REQS], *cbp[AIO_MAX_REQS];
+    struct io_event events[AIO_MAX_REQS];
+    struct timespec timeout = { .tv_sec = 2, .tv_nsec = 0 };
+    aio_context_t ctx = 0;
+
+    if ((nreq < 1) || (nreq > AIO_MAX_REQS)) {
+        printf("错误：请求数须在 1~%d 之间\n", AIO_MAX_REQS);
+        return;
+    }
+    if (syscall(__NR_io_setup, nreq, &ctx) < 0) {
+        perror("io_setup 失败");
+        return;
+    }
+    memset(cbs, 0, sizeof(cbs));
+    for (int i = 0; i < nreq; i++) {
+        cbs[i].aio_data       = i;
+        cbs[i].aio_fildes     = fd;
+        cbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+        cbs[i].aio_buf        = (uint64_t)(uintptr_t)bufs[i];
+        cbs[i].aio_nbytes     = AIO_REQ_LEN;
+        cbp[i] = &cbs[i];
+    }
+
+    long long t0 = now_ns();
+    long submitted = syscall(__NR_io_submit, ctx, nreq, cbp);
+    if (submitted < 0) {
+        perror("io_submit 失败");
+        goto out;
+    }
+    printf("已挂起 %ld 个异步读，提交耗时 %.2f us\n", submitted, (now_ns() - t0) / 1000.0);
+
+    memset(payload, 0, sizeof(payload));
+    for (int i = 0; i < nreq; i++) {
+        payload[i * AIO_REQ_LEN + 1] = i; /* 首字节保持关灯，第二字节标记请求序号 */
+    }
+    t0 = now_ns();
+    if (write(fd, payload, nreq * AIO_REQ_LEN) < 0) {
+        perror("写入数据失败");
+        goto out;
+    }
+    long got = syscall(__NR_io_getevents, ctx, submitted, submitted, events, &timeout);
+    if (got < 0) {
+        perror("io_getevents 失败");
+        goto out;
+    }
+    printf("写入后 %.2f us 内完成 %ld 个异步读\n", (now_ns() - t0) / 1000.0, got);
+    for (int i = 0; i < got; i++) {
+        printf("  请求 %llu：结果 %lld\n", (unsigned long long)events[i].data, (long long)events[i].res);
+    }
+out:
+    syscall(__NR_io_destroy, ctx);
+}
+
+#ifdef IORING_SETUP_SQE128  /* 头文件足够新（>= 5.19）才有 uring_cmd 的 cmd_op/cmd 字段 */
+/* 
+ * io_uring 控制命令基准：每次提交 batch 个 IORING_OP_URING_CMD（cmd_op = GET_DATA_LEN），
+ * 一次 io_uring_enter 提交并收割全部完成事件；对照组为同样次数的逐个 ioctl。
+ * 为了不依赖 liburing，这里直接用系统调用并自行映射 SQ/CQ 环。
+ */
+void bench_uring(int fd, int batch) {
+    struct io_uring_params p;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+    size_t sq_sz, cq_sz, sqe_sz;
+    char *sq_ptr, *cq_ptr;
+    long long t0, t_uring, t_ioctl;
+    int len, ring, done = 0;
+
+    if ((batch < 1) || (batch > URING_MAX_BATCH)) {
+        printf("错误：批量须在 1~%d 之间\n", URING_MAX_BATCH);
+        return;
+    }
+    memset(&p, 0, sizeof(p));
+    ring = syscall(__NR_io_uring_setup, URING_MAX_BATCH, &p);
+    if (ring < 0) {
+        perror("io_uring_setup 失败");
+        return;
+    }
+    sq_sz  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_sz  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sqe_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    sq_ptr = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    cq_ptr = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    sqes   = mmap(NULL, sqe_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if ((sq_ptr == MAP_FAILED) || (cq_ptr == MAP_FAILED) || (sqes == MAP_FAILED)) {
+        perror("映射 io_uring 环失败");
+        goto out;
+    }
+    sq_tail  = (unsigned *)(sq_ptr + p.sq_off.tail);
+    sq_mask  = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+    cq_head  = (unsigned *)(cq_ptr + p.cq_off.head);
+    cq_tail  = (unsigned *)(cq_ptr + p.cq_off.tail);
+    cq_mask  = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+    cqes     = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+    t0 = now_ns();
+    while (done < BENCH_ROUNDS) {
+        unsigned tail = *sq_tail;
+        for (int i = 0; i < batch; i++, tail++) {
+            struct io_uring_sqe *sqe = &sqes[tail & *sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_URING_CMD;
+            sqe->fd     = fd;
+            sqe->cmd_op = GET_DATA_LEN;
+            sq_array[tail & *sq_mask] = tail & *sq_mask;
+        }
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        if (syscall(__NR_io_uring_enter, ring, batch, batch, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            perror("io_uring_enter 失败");
+            goto out;
+        }
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+            if (cqe->res < 0) {
+                printf("uring_cmd 失败：%s\n", strerror(-cqe->res));
+                goto out;
+            }
+            len = cqe->res;
+            head++;
+            done++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+    t_uring = now_ns() - t0;
+
+    t0 = now_ns();
+    for (int r = 0; r < done; r++) {
+        if (ioctl(fd, GET_DATA_LEN, &len) < 0) {
+            perror("ioctl 失败");
+            goto out;
+        }
+    }
+    t_ioctl = now_ns() - t0;
+
+    printf("io_uring 控制命令基准：%d 条命令，每批 %d 条，当前数据长度 %d\n", done, batch, len);
+    printf("  io_uring uring_cmd：每条 %.3f us\n", t_uring / 1000.0 / done);
+    printf("  逐个 ioctl        ：每条 %.3f us\n", t_ioctl / 1000.0 / done);
+    printf("  加速比：%.2f\n", (double)t_ioctl / t_uring);
+out:
+    if ((sqes != NULL) && (sqes != MAP_FAILED)) munmap(sqes, sqe_sz);
+    if ((cq_ptr != NULL) && (cq_ptr != MAP_FAILED)) munmap(cq_ptr, cq_sz);
+    if ((sq_ptr != NULL) && (sq_ptr != MAP_FAILED)) munmap(sq_ptr, sq_sz);
+    close(ring);
+}
+#else
+void bench_uring(int fd, int batch) {
+    (void)fd;
+    (void)batch;
+    printf("错误：编译用的内核头文件太旧，不支持 io_uring 的 uring_cmd\n");
+}
+#endif
+
+/* 典型的控制序列：清空 → 登记长度 → 查询长度 → 关灯，填进 cmds 的前 4 条 */
+void fill_ctl_seq(struct chrdev_batch_cmd *cmds) {
+    memset(cmds, 0, 4 * sizeof(*cmds));
+    cmds[0].cmd = CLEAR_BUF;
+    cmds[1].cmd = MAPLEAY_UPDATE_DAT_LEN;
+    cmds[1].arg = 1;
+    cmds[2].cmd = GET_DATA_LEN;
+    cmds[3].cmd = LED_SET;
+    cmds[3].arg = 0;
+}
+
+/* 批量控制基准：同一串 4 条命令，BATCH_EXEC 一次提交 对比 逐条 ioctl（平铺模式 buf_mode=0） */
+void bench_batch(int fd, int rounds) {
+    struct chrdev_batch_cmd cmds[4];
+    struct chrdev_batch batch;
+    long long t0, t_batch, t_ioctl;
+    int val;
+
+    if (rounds < 1) {
+        rounds = BENCH_ROUNDS;
+    }
+
+    /* 先跑一遍，把每条命令的结果打出来 */
+    fill_ctl_seq(cmds);
+    memset(&batch, 0, sizeof(batch));
+    batch.cmds  = (uintptr_t)cmds;
+    batch.count = 4;
+    batch.flags = CHRDEV_BATCH_STOP_ON_ERR;
+    if (ioctl(fd, BATCH_EXEC, &batch) < 0) {
+        perror("BATCH_EXEC 失败");
+        return;
+    }
+    printf("批量执行了 %u 条：\n", batch.done);
+    for (unsigned i = 0; i < batch.done; i++) {
+        printf("  [%u] cmd=0x%08x arg=%d result=%d\n", i, cmds[i].cmd, cmds[i].arg, cmds[i].result);
+    }
+
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        fill_ctl_seq(cmds);
+        batch.done = 0;
+        if ((ioctl(fd, BATCH_EXEC, &batch) < 0) || (batch.done != 4)) {
+            perror("BATCH_EXEC 失败");
+            return;
+        }
+    }
+    t_batch = now_ns() - t0;
+
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        val = 1;
+        if ((ioctl(fd, CLEAR_BUF) < 0) || (ioctl(fd, MAPLEAY_UPDATE_DAT_LEN, &val) < 0) ||
+            (ioctl(fd, GET_DATA_LEN, &val) < 0) || (val = 0, ioctl(fd, LED_SET, &val) < 0)) {
+            perror("ioctl 失败");
+            return;
+        }
+    }
+    t_ioctl = now_ns() - t0;
+
+    printf("批量控制基准：每轮 4 条命令，%d 轮\n", rounds);
+    printf("  BATCH_EXEC：每轮 %.2f us\n", t_batch / 1000.0 / rounds);
+    printf("  逐条 ioctl：每轮 %.2f us\n", t_ioctl / 1000.0 / rounds);
+    printf("  加速比：%.2f\n", (double)t_ioctl / t_batch);
+}
+
+/* 
+ * 开关灯吞吐基准：交替发 LED_SET 开/关，每次都真的切换状态、写一次 BSRR。
+ * 驱动用模拟寄存器时（没有开发板也能跑），顺带打出 debugfs 里各寄存器的读写次数，
+ * 可以核对每次开关灯是否只有一次寄存器写。
+ */
+void bench_led(int fd, int total) {
+    long long t0, t;
+    char line[128];
+    FILE *fp;
+
+    if (total <= 0) {
+        printf("错误：次数须大于 0\n");
+        return;
+    }
+    t0 = now_ns();
+    for (int i = 0; i < total; i++) {
+        int sta = !(i & 1);
+        if (ioctl(fd, LED_SET, &sta) < 0) {
+            perror("开关灯失败");
+            return;
+        }
+    }
+    t = now_ns() - t0;
+    printf("开关灯基准：%d 次\n", total);
+    printf("  每次 %.3f us，%.2f M 次/秒\n", t / 1000.0 / total, total * 1000.0 / t);
+
+    fp = fopen(SIM_REGS_DEBUGFS, "r");
+    if (fp == NULL) {
+        return;     /* 真实硬件，或没有权限读 debugfs */
+    }
+    printf("模拟寄存器：\n");
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        printf("  %s", line);
+    }
+    fclose(fp);
+}
+
+/* 
+ * 命令环基准：经共享内存的提交环发 total 条 LED_SET（交替开关灯），对比逐条 pwrite 1 字节开关灯。
+ * sqpoll 为 1 时请内核起轮询线程，只有线程睡下了才敲门铃；命令环已建立时沿用原来的方式。
+ */
+void bench_ring(int fd, int total, int sqpoll) {
+    struct chrdev_ring_params p;
+    struct chrdev_ring_hdr *hdr;
+    struct chrdev_sqe *sqes;
+    struct chrdev_cqe *cqes;
+    unsigned tail, head, chead, ctail;
+    long long t0, t_ring, t_write, enters = 0, errors = 0;
+    int submitted = 0, completed = 0;
+    char *mem, c;
+
+    if (total < 1) {
+        total = BENCH_ROUNDS;
+    }
+    memset(&p, 0, sizeof(p));
+    p.sq_entries = RING_ENTRIES;
+    p.flags = sqpoll ? CHRDEV_RING_SQPOLL : 0;
+    if (ioctl(fd, RING_SETUP, &p) < 0) {
+        perror("建立命令环失败");
+        return;
+    }
+    if (sqpoll && !(p.flags & CHRDEV_RING_SQPOLL)) {
+        printf("注意：命令环早先已按门铃方式建立，本次仍用门铃\n");
+    }
+    mem = mmap(NULL, p.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, CHRDEV_RING_MMAP_OFF);
+    if (mem == MAP_FAILED) {
+        perror("映射命令环失败");
+        return;
+    }
+    hdr  = (struct chrdev_ring_hdr *)mem;
+    sqes = (struct chrdev_sqe *)(mem + p.sq_off);
+    cqes = (struct chrdev_cqe *)(mem + p.cq_off);
+
+    t0 = now_ns();
+    while (completed < total) {
+        /* 提交：提交环有空位就填，填完一次性发布 sq_tail */
+        tail = hdr->sq_tail;
+        head = __atomic_load_n(&hdr->sq_head, __ATOMIC_ACQUIRE);
+        while ((submitted < total) && (tail - head < p.sq_entries)) {
+            struct chrdev_sqe *sqe = &sqes[tail & hdr->sq_mask];
+            sqe->cmd = LED_SET;
+            sqe->arg = submitted & 1;
+            sqe->user_data = submitted;
+            tail++;
+            submitted++;
+        }
+        __atomic_store_n(&hdr->sq_tail, tail, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);  /* 先发布 sq_tail 再看 NEED_WAKEUP */
+        if (!(p.flags & CHRDEV_RING_SQPOLL) || (hdr->flags & CHRDEV_RING_NEED_WAKEUP)) {
+            if (ioctl(fd, RING_ENTER) < 0) {
+                perror("RING_ENTER 失败");
+                break;
+            }
+            enters++;
+        }
+
+        /* 收割：完成项与提交项顺序一致 */
+        chead = hdr->cq_head;
+        ctail = __atomic_load_n(&hdr->cq_tail, __ATOMIC_ACQUIRE);
+        while (chead != ctail) {
+            if (cqes[chead & hdr->cq_mask].res < 0) {
+                errors++;
+            }
+            chead++;
+            completed++;
+        }
+        __atomic_store_n(&hdr->cq_head, chead, __ATOMIC_RELEASE);
+    }
+    t_ring = now_ns() - t0;
+    munmap(mem, p.ring_size);
+
+    t0 = now_ns();
+    for (int r = 0; r < total; r++) {
+        c = r & 1;
+        if (pwrite(fd, &c, 1, 0) != 1) {
+            perror("pwrite 失败");
+            return;
+        }
+    }
+    t_write = now_ns() - t0;
+
+    printf("命令环基准：%d 条开关灯命令，%s，门铃 %lld 次，失败 %lld 条\n", completed,
+           (p.flags & CHRDEV_RING_SQPOLL) ? "内核轮询线程" : "门铃", enters, errors);
+    printf("  命令环    ：%.2f M 条/秒\n", completed * 1000.0 / t_ring);
+    printf("  逐条 write：%.2f M 条/秒\n", total * 1000.0 / t_write);
+}
+
+/* 并发写基准的线程参数：各线程反复 pwrite 自己的区间 */
+struct mt_arg {
+    int fd;
+    off_t offset;
+    int err;
+};
+
+void *mt_writer(void *p) {
+    struct mt_arg *arg = p;
+    char chunk[MT_REGION];
+
+    memset(chunk, 'M', sizeof(chunk));
+    chunk[0] = 0; /* 0 号区间的首字节就是缓冲区首字节：保持关灯 */
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        if (pwrite(arg->fd, chunk, sizeof(chunk), arg->offset) != sizeof(chunk)) {
+            arg->err = errno;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* 
+ * 并发写基准（平铺/稀疏模式）：线程数从 1 倍增到 nthr，每个线程 pwrite 自己的 1KB 区间。
+ * 驱动按条带加锁，互不重叠的区间落在不同条带上，总吞吐应随核数上升。
+ */
+void bench_mt(int fd, int nthr) {
+    pthread_t tids[MT_MAX_THREADS];
+    struct mt_arg args[MT_MAX_THREADS];
+    int size;
+
+    if ((nthr < 1) || (nthr > MT_MAX_THREADS)) {
+        printf("错误：线程数须在 1~%d 之间\n", MT_MAX_THREADS);
+        return;
+    }
+    if (ioctl(fd, GET_BUF_SIZE, &size) < 0) {
+        perror("获取缓冲区大小失败");
+        return;
+    }
+    if (size < nthr * MT_REGION) {  /* 每个线程一个区间，缓冲区不够就先扩容 */
+        size = nthr * MT_REGION;
+        if (ioctl(fd, RESIZE_BUF, &size) < 0) {
+            perror("扩大缓冲区失败");
+            return;
+        }
+    }
+
+    printf("并发写基准：每线程 %d 次 pwrite x %d 字节\n", BENCH_ROUNDS, MT_REGION);
+    /* 线程数依次为 1、2、4……，最后一轮取 nthr */
+    for (int n = 1; n <= nthr; n = (n * 2 > nthr && n < nthr) ? nthr : n * 2) {
+        long long t0 = now_ns();
+        for (int i = 0; i < n; i++) {
+            args[i].fd = fd;
+            args[i].offset = (off_t)i * MT_REGION;
+            args[i].err = 0;
+            pthread_create(&tids[i], NULL, mt_writer, &args[i]);
+        }
+        for (int i = 0; i < n; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        long long t = now_ns() - t0;
+        for (int i = 0; i < n; i++) {
+            if (args[i].err) {
+                printf("线程 %d 写入失败：%s\n", i, strerror(args[i].err));
+                return;
+            }
+        }
+        printf("  %2d 线程：%.2f MB/s\n", n, (double)n * BENCH_ROUNDS * MT_REGION * 1000.0 / t);
+    }
+}
+
+/* 每 CPU 基准的生产者：绑到 cpu 号核上，连续写 BENCH_ROUNDS 条记录 */
+struct pcpu_arg {
+    int fd;
+    int id;
+    int err;
+};
+
+void *pcpu_producer(void *p) {
+    struct pcpu_arg *arg = p;
+    char rec[PCPU_REC_LEN];
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(arg->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    memset(rec, 0, sizeof(rec)); /* 首字节为 0：保持关灯 */
+    rec[1] = arg->id;
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+        memcpy(&rec[4], &r, sizeof(r)); /* 记录序号：用于校验归并后的顺序 */
+        if (write(arg->fd, rec, sizeof(rec)) != sizeof(rec)) {
+            arg->err = errno;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* 
+ * 每 CPU 模式基准（buf_mode=4）：生产者数从 1 倍增到 nthr，各自绑在不同的核上写记录，看总吞吐的变化；
+ * 最后一轮结束后把环中剩下的记录全部读出，检查同一生产者的记录序号在归并流中是递增的。
+ */
+void bench_pcpu(int fd, int nthr) {
+    pthread_t tids[MT_MAX_THREADS];
+    struct pcpu_arg args[MT_MAX_THREADS];
+    static char stream[MT_MAX_THREADS * 1024 * PCPU_REC_LEN];
+    long last[MT_MAX_THREADS];
+    long total = 0, bad = 0;
+    ssize_t n;
+
+    if ((nthr < 1) || (nthr > MT_MAX_THREADS)) {
+        printf("错误：线程数须在 1~%d 之间\n", MT_MAX_THREADS);
+        return;
+    }
+
+    printf("每 CPU 写入基准：每线程 %d 条 x %d 字节\n", BENCH_ROUNDS, PCPU_REC_LEN);
+    for (int k = 1; k <= nthr; k = (k * 2 > nthr && k < nthr) ? nthr : k * 2) {
+        ioctl(fd, CLEAR_BUF);
+        long long t0 = now_ns();
+        for (int i = 0; i < k; i++) {
+            args[i].fd = fd;
+            args[i].id = i;
+            args[i].err = 0;
+            pthread_create(&tids[i], NULL, pcpu_producer, &args[i]);
+        }
+        for (int i = 0; i < k; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        long long t = now_ns() - t0;
+        for (int i = 0; i < k; i++) {
+            if (args[i].err) {
+                printf("线程 %d 写入失败：%s\n", i, strerror(args[i].err));
+                return;
+            }
+        }
+        printf("  %2d 线程：%.2f 万条/秒\n", k, (double)k * BENCH_ROUNDS * 1e5 / t);
+    }
+
+    /* 各核环中留下的是最新的记录（旧的已被覆盖），归并读出后逐线程检查序号 */
+    for (int i = 0; i < nthr; i++) {
+        last[i] = -1;
+    }
+    while ((n = read(fd, stream, sizeof(stream))) > 0) {
+        for (ssize_t off = 0; off + PCPU_REC_LEN <= n; off += PCPU_REC_LEN) {
+            uint32_t seq;
+            int id = stream[off + 1];
+            memcpy(&seq, &stream[off + 4], sizeof(seq));
+            if ((id >= 0) && (id < nthr)) {
+                bad += ((long)seq <= last[id]);
+                last[id] = seq;
+            }
+            total++;
+        }
+    }
+    printf("归并读出 %ld 条记录，同一生产者内乱序 %ld 条\n", total, bad);
+}
+
+/* 用法：./testapp.out [设备文件]，多个次设备时可指定 /dev/mapleay-chrdev-device-1 等 */
+int main(int argc, char *argv[]) {
     
     char input[MAX_INPUT_LEN];
     char cmd[MAX_INPUT_LEN];
     char param[MAX_INPUT_LEN];
     
-    int fd = open(DEVICE_FILE, O_RDWR, 0777);
+    const char *dev_file = (argc > 1) ? argv[1] : DEVICE_FILE;
+    int fd = open(dev_file, O_RDWR, 0777);
     if (fd < 0) {
         perror("应用层：打开设备文件失败！");
         return -1;
@@ -129,6 +946,15 @@ int main() {
             } else {
                 printf("当前数据长度：%d 字节\n", len);
             }
+        } else if (strcmp(cmd, "meta") == 0) {
+            struct chrdev_meta meta;
+            if (ioctl(fd, GET_META, &meta) < 0) {
+                perror("获取元数据失败");
+            } else {
+                printf("缓冲区大小 %llu 字节，数据长度 %llu 字节，写代数 %llu\n",
+                       (unsigned long long)meta.buf_size, (unsigned long long)meta.data_len,
+                       (unsigned long long)meta.wr_gen);
+            }
         } else if (strcmp(cmd, "update_len") == 0) {
             if (num_args < 2) {
                 printf("错误：缺少长度参数，用法：u <长度>\n");
@@ -145,6 +971,120 @@ int main() {
             if (ioctl(fd, PRINT_BUF_DATA) < 0) {
                 perror("请内核中打印缓冲区数据失败");
             }
+        } else if (strcmp(cmd, "resize") == 0) {
+            if (num_args < 2) {
+                printf("错误：缺少大小参数，用法：resize <字节数>\n");
+                print_usage();
+                continue;
+            }
+            int size = atoi(param);
+            if (ioctl(fd, RESIZE_BUF, &size) < 0) {
+                perror("调整缓冲区大小失败");
+            } else {
+                printf("缓冲区大小已调整为 %d 字节\n", size);
+            }
+        } else if (strcmp(cmd, "mt") == 0) {               /* 多线程并发写基准 */
+            bench_mt(fd, (num_args < 2) ? 4 : atoi(param));
+        } else if (strcmp(cmd, "pcpu") == 0) {             /* 每 CPU 生产者基准 */
+            bench_pcpu(fd, (num_args < 2) ? 4 : atoi(param));
+        } else if (strcmp(cmd, "instr") == 0) {            /* 插桩开销基准 */
+            bench_instr(fd, (num_args < 2) ? BENCH_ROUNDS : atoi(param));
+        } else if (strcmp(cmd, "extents") == 0) {          /* 列出数据段和空洞 */
+            print_extents(fd);
+        } else if (strcmp(cmd, "mw") == 0) {               /* 经 mmap 写入 */
+            if (num_args < 2) {
+                printf("错误：缺少写入数据，用法：mw <string>\n");
+                print_usage();
+                continue;
+            }
+            int size;
+            char *map = map_device(fd, &size);
+            if (map == NULL) {
+                continue;
+            }
+            /* 数据直接写进内核缓冲区，随后只用 ioctl 登记有效长度 */
+            int cnt = strlen(param);
+            if (cnt > size) {
+                cnt = size;
+            }
+            memcpy(map, param, cnt);
+            int len = cnt; /* ioctl 会回写特殊状态码，另存一份 */
+            if (ioctl(fd, MAPLEAY_UPDATE_DAT_LEN, &len) < 0) {
+                perror("更新数据长度失败");
+            } else {
+                printf("经 mmap 写入 %d 字节\n", cnt);
+            }
+            munmap(map, size);
+        } else if (strcmp(cmd, "poll") == 0) {             /* 等待可读再读取 */
+            int timeout_ms = (num_args < 2) ? -1 : atoi(param);
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready < 0) {
+                perror("poll 失败");
+            } else if (ready == 0) {
+                printf("等待超时，设备暂无数据\n");
+            } else {
+                char read_buf[1024];
+                ssize_t cnt_read = read(fd, read_buf, sizeof(read_buf));
+                if (cnt_read < 0) {
+                    perror("读取内核失败！");
+                } else {
+                    printf("设备可读，读取到 %zd 字节：\n", cnt_read);
+                    for (int i = 0; i < cnt_read; i++) {
+                        printf("%d ", read_buf[i]);
+                    }
+                    printf("\n");
+                }
+            }
+        } else if (strcmp(cmd, "sg") == 0) {               /* 分散聚集基准 */
+            bench_sg(fd, (num_args < 2) ? 2 : atoi(param));
+        } else if (strcmp(cmd, "splice") == 0) {           /* splice 搬运基准 */
+            if (num_args < 2) {
+                printf("错误：缺少输出文件，用法：splice <文件>\n");
+                print_usage();
+                continue;
+            }
+            bench_splice(fd, param);
+        } else if (strcmp(cmd, "aio") == 0) {              /* 异步读演示 */
+            demo_aio(fd, (num_args < 2) ? 8 : atoi(param));
+        } else if (strcmp(cmd, "batch") == 0) {            /* 批量控制命令基准 */
+            bench_batch(fd, (num_args < 2) ? BENCH_ROUNDS : atoi(param));
+        } else if (strcmp(cmd, "ring") == 0) {             /* 命令环：敲门铃消费 */
+            bench_ring(fd, (num_args < 2) ? BENCH_ROUNDS : atoi(param), 0);
+        } else if (strcmp(cmd, "ringpoll") == 0) {         /* 命令环：内核轮询线程消费 */
+            bench_ring(fd, (num_args < 2) ? BENCH_ROUNDS : atoi(param), 1);
+        } else if (strcmp(cmd, "led") == 0) {              /* 直接开关灯 */
+            int sta = (num_args < 2) ? 0 : atoi(param);
+            if (ioctl(fd, LED_SET, &sta) < 0) {
+                perror("开关灯失败");
+            }
+        } else if (strcmp(cmd, "ledbench") == 0) {         /* 开关灯吞吐基准 */
+            bench_led(fd, (num_args < 2) ? BENCH_ROUNDS : atoi(param));
+        } else if (strcmp(cmd, "led_get") == 0) {          /* 读 LED 状态 */
+            int sta;
+            if (ioctl(fd, LED_GET, &sta) < 0) {
+                perror("读 LED 状态失败");
+            } else {
+                printf("LED 当前%s\n", sta ? "亮" : "灭");
+            }
+        } else if (strcmp(cmd, "uring") == 0) {            /* io_uring 控制命令基准 */
+            bench_uring(fd, (num_args < 2) ? 16 : atoi(param));
+        } else if (strcmp(cmd, "mr") == 0) {               /* 经 mmap 读出 */
+            int size, len;
+            char *map = map_device(fd, &size);
+            if (map == NULL) {
+                continue;
+            }
+            if (ioctl(fd, GET_DATA_LEN, &len) < 0) {
+                perror("获取数据长度失败");
+            } else {
+                printf("经 mmap 读到 %d 字节：\n", len);
+                for (int i = 0; i < len; i++) {
+                    printf("%d ", map[i]);
+                }
+                printf("\n");
+            }
+            munmap(map, size);
         } else {
             printf("未知命令：%s\n", cmd);
             print_usage();